@@ -16,18 +16,38 @@
 #include "my_fp.h"
 #include "params.h"
 
+#define BMS_BYTE_US          17    // 10 bits at 612500 baud
+
 class BMSUtil
 {
 public:
+    /* Reply counters for one module or the broadcast address */
+    struct LinkStats
+    {
+        uint16_t good;
+        uint16_t bad;        // failed on every attempt
+        uint16_t crcErrors;
+        uint16_t timeouts;
+        uint16_t retries;
+    };
+    
+    enum { REPLY_OK, REPLY_TIMEOUT, REPLY_CRC };
+    
     /* SOC calculation (existing) */
     static void UpdateSOC();
     static int  EstimateSocFromVoltage();
     
     /* Tesla BMS protocol (new) */
+    static void    UartStart();
+    static int     RxAvailable();
+    static bool    ReplyComplete(int expected);
+    static int     ReplyTimeUs();
+    static void    UartInterrupt();
+    static int     ReadReply(uint8_t *data, int maxLen);
     static uint8_t GenCRC(uint8_t *input, int lenInput);
     static void    SendData(uint8_t *data, uint8_t dataLen, bool isWrite);
-    static int     GetReply(uint8_t *data, int maxLen);
-    static int     SendDataWithReply(uint8_t *data, uint8_t dataLen, bool isWrite, uint8_t *retData, int retLen);
+    static int     CheckReply(const uint8_t *data, int len, int expected);
+    static void    CountReply(LinkStats *stats, int result, bool final);
 
 private:
 };
@@ -6,6 +6,8 @@
     A short bmb will only report 23 voltage values where as a long will report 25.
 */
 #include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/rtc.h>
 #include <stdint.h>
 #include "params.h"
@@ -19,34 +21,39 @@ class BATMan
 public:
     static      void BatStart();
     static		void loop();
+    static      void SetScanTime(int ms);
+    static      void SpiInterrupt();
+    static      void TimerInterrupt();
 
 
 
 private:
     static      void StateMachine();
     static      void IdleWake();
+    static      void QueueSnapshot();
+    static      void EndCycle();
+    static      void QueueRetries();
     static		void GetData(uint8_t ReqID);
+    static      void ProbeChain();
+    static      void CountChips(const uint16_t* rxData);
+    static      void DecodeData(uint8_t ReqID, const uint16_t* rxData);
     static		void WakeUP();
     static		void Generic_Send_Once(uint16_t Command[], uint8_t len);
-    static      void delay(int16_t FLASH_DELAY)
-    {
-        int i;
-        for (i = 0; i < FLASH_DELAY; i++)       /* Wait a bit. */
-            __asm__("nop");
-    }
+    static      void Wait(uint16_t us);
+    static      void QueueCommand(const uint16_t* cmd, uint8_t cmdLen, uint8_t len, uint8_t ReqID);
+    static      void RunSequence();
+    static      void AbortSequence();
+    static      void StartOp();
     static       void GetTempData();
     static       void upDateCellVolts(void);
     static       void upDateAuxVolts(void);
     static       void upDateTemps(void);
+    static       void upDatePecStats(void);
     static       void WriteCfg();
     static       uint16_t rev16(uint16_t x)
     {
         return (x << 8) | (x >>8);
     }
-    static       uint8_t calcCRC(uint8_t *inData, uint8_t Length);
-
-    static       void crc14_bytes( uint8_t len_B, uint8_t *bytes, uint16_t *crcP );
-    static       void crc14_bits( uint8_t len_b,uint8_t inB, uint16_t *crcP );
 };
 
 #endif /* BATMan_h */
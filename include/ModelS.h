@@ -13,6 +13,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "params.h"
+#include "BMSUtil.h"
 
 #define MAX_MODULES 20  // Maximum Tesla BMS modules supported
 
@@ -21,94 +22,116 @@ class TeslaBMSModule
 public:
     TeslaBMSModule();
     
-    void readStatus();
-    bool readModuleValues();
-    void stopBalance();
-    void clearModule();
+    void decodeStatus(const uint8_t *buff);
+    bool hasFault();
+    bool decodeValues(const uint8_t *buff, int retLen);
     
-    float getCellVoltage(int cell);
-    float getLowCellV();
-    float getHighCellV();
-    float getAverageV();
-    float getModuleVoltage();
+    /* Voltages in mV, temperatures in 0.1 degC */
+    int getCellVoltage(int cell);
+    int getLowCellV();
+    int getHighCellV();
+    int getModuleVoltage();
     
-    float getTemperature(int temp);
-    float getLowTemp();
-    float getHighTemp();
-    float getAvgTemp();
+    int getTemperature(int temp);
+    int getLowTemp();
+    int getHighTemp();
+    int getAvgTemp();
     
     uint8_t getFaults();
     uint8_t getAlerts();
     uint8_t getCOVCells();
     uint8_t getCUVCells();
     
+    BMSUtil::LinkStats *getLink();
+    
     void setAddress(int newAddr);
     int  getAddress();
     bool isExisting();
     void setExists(bool ex);
+    bool lostContact(bool ok);
+    bool isConfigured();
+    void setConfigured(bool cfg);
     int  getNumCells();
 
 private:
-    float    cellVolt[6];
-    float    lowestCellVolt[6];
-    float    highestCellVolt[6];
-    float    moduleVolt;
-    float    temperatures[2];
-    float    lowestTemperature;
-    float    highestTemperature;
+    uint16_t cellVolt[6];
+    uint16_t lowestCellVolt[6];
+    uint16_t highestCellVolt[6];
+    uint16_t moduleVolt;
+    int16_t  temperatures[2];
+    int16_t  lowestTemperature;
+    int16_t  highestTemperature;
     bool     exists;
+    bool     configured;  // ADC and IO control written since the last reset
+    uint8_t  misses;      // value reads failed in a row
     uint8_t  alerts;
     uint8_t  faults;
     uint8_t  COVFaults;
     uint8_t  CUVFaults;
     uint8_t  moduleAddress;
-    int      scells;  // Actual cell count
-    int      smiss;   // Miss counter for cell count stability
+    BMSUtil::LinkStats link;
 };
 
 class TeslaBMSManager
 {
 public:
     static void Init();
-    static void Task100Ms();  // Called from scheduler
+    static void Task10Ms();  // Called from scheduler, one bus transaction per call
     
-    /* Bus management */
+    /* Bus management, queued and run in place of the next scan cycle */
     static void RenumberModules();
     static void FindModules();
     static void ClearFaults();
+    static bool IsBusy();
     
-    /* Data acquisition */
-    static void GetAllVoltTemp();
-    
-    /* Cell balancing */
-    static void BalanceCells();
-    static void StopBalancing();
-    
-    /* Pack readings → published to Param:: */
-    static float GetPackVoltage();
-    static float GetAvgCellVolt();
-    static float GetLowCellVolt();
-    static float GetHighCellVolt();
-    static float GetAvgTemp();
-    static float GetLowTemp();
-    static float GetHighTemp();
+    /* Pack readings → published to Param:: (mV and 0.1 degC) */
+    static int32_t GetPackVoltage();
+    static int   GetAvgCellVolt();
+    static int   GetLowCellVolt();
+    static int   GetHighCellVolt();
+    static int   GetAvgTemp();
+    static int   GetLowTemp();
+    static int   GetHighTemp();
     static int   GetNumModules();
     static int   GetTotalCells();
     
 private:
     static TeslaBMSModule modules[MAX_MODULES + 1];  // index 1..MAX_MODULES
     static int   numFoundModules;
-    static float packVolt;
-    static float lowCellVolt;
-    static float highCellVolt;
-    static float avgTemp;
-    static float lowTemp;
-    static float highTemp;
+    static int32_t packVolt;
+    static int   lowCellVolt;
+    static int   highCellVolt;
+    static int   avgTemp;
+    static int   lowTemp;
+    static int   highTemp;
     static int   totalCells;
+    static uint16_t cells[MAX_MODULES * 6];  // mV, module order, feeds u1..u120
+    static int   numCells;
     static bool  initialized;
     
-    static void SetupBoards();
+    static void Request(uint8_t addr, uint8_t reg, uint8_t data, bool isWrite, int replyLen);
+    static void Send();
+    static void StartCycle();
+    static void NextRequest();
+    static void HandleReply(int retLen);
+    static void EndCycle();
+    static void Aggregate();
+    static void StartScan();
+    static int  ModuleState(int y);
+    static int  ReadState(int y);
+    static bool AllConfigured();
+    static BMSUtil::LinkStats *LinkOf(int addr);
+    static int  WireTimeUs();
+    static void MeasureLatency();
+    static int  NextModule(int from);
+    static int  NextMissing(int from);
+    static uint8_t BalanceMask(int y);
+    static void UpdateBalance();
+    static void SyncBalance(int next, int nextModule);
+    static int  NextBalanceSync(int from);
+    static int  BalanceState(int y);
     static void PublishToParams();
+    static void PublishLinkStats();
 };
 
 #endif /* MODSX_h */
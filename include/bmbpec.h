@@ -0,0 +1,37 @@
+#ifndef BMBPEC_h
+#define BMBPEC_h
+
+/*  PEC of the BATMan data frames, header only so the host test runs the
+ *  same code as the firmware.
+ *  Each chip block ends in a 16 bit word sent high byte first, two data bits
+ *  followed by the 14 bit PEC. The PEC covers every byte before that word
+ *  plus the two data bits and is seeded with 0x0010, the same way for the
+ *  blocks we write and the ones the chips send back.
+ */
+#include <stdint.h>
+#include "crc.h"
+
+#define BMB_PEC_BYTES    2  //trailing 2 data bits plus 14 bit PEC of each chip block
+
+class BmbPec
+{
+public:
+    //PEC of len bytes followed by the top two bits of tail
+    static uint16_t Calc(const uint8_t* data, uint8_t len, uint8_t tail)
+    {
+        return DataCrc::Bits(DataCrc::Calc(data, len, 0x0010), tail, 2);
+    }
+
+    static bool Check(const uint8_t* block, uint8_t len)
+    {
+        uint8_t pecHi = block[len - BMB_PEC_BYTES];
+        uint16_t pec = Calc(block, len - BMB_PEC_BYTES, pecHi);
+
+        return pec == (((pecHi << 8) | block[len - 1]) & 0x3fff);
+    }
+
+private:
+    typedef Crc<uint16_t, 14, 0x025B> DataCrc;
+};
+
+#endif /* BMBPEC_h */
@@ -0,0 +1,49 @@
+/*
+ * This file is part of the RaVus BMS project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COULOMB_H
+#define COULOMB_H
+
+/*  Coulomb counter fed straight from the shunt's current frames.
+ *
+ *  AddSample() is called from the CAN receive path for every ISA 0x521 or
+ *  SBOX 0x200 frame. It stamps the frame with the CPU cycle counter and
+ *  integrates current (trapezoid) and power into 64 bit nC / nJ
+ *  accumulators, so nothing is lost between the 100 ms tasks.
+ *  Gaps of up to COULOMB_HOLD_MS are integrated (trapezoid), longer gaps
+ *  are skipped and counted in CoulGaps.
+ *
+ *  Throughput counters and SOC are logged to two flash pages used in
+ *  turn and restored by Init() from the newest record of either. A record
+ *  is written once SOC moved 1% or 1 Ah went through, at most once a
+ *  minute. Save() does the flash write and belongs in the main loop, not
+ *  in an interrupt.
+ */
+
+#include <stdint.h>
+
+class CoulombCounter
+{
+public:
+    static void Init();
+    static void AddSample(int32_t milliAmps, int32_t milliVolts);
+    static void Task100Ms();
+    static int32_t TakeCharge(int64_t unitNc);
+    static void Save();
+};
+
+#endif // COULOMB_H
@@ -0,0 +1,119 @@
+#ifndef CRC_h
+#define CRC_h
+
+/*  Table driven CRC engine shared by all BMS protocols.
+ *  Tables are generated by the compiler for the given width and polynomial
+ *  and land in flash. Byte tables take one lookup per byte, nibble tables
+ *  take two but only need 16 entries.
+ *
+ *  Crc<uint8_t, 8, 0x2F>                 BATMan command PEC
+ *  Crc<uint16_t, 14, 0x025B>             BATMan data PEC
+ *  Crc<uint8_t, 8, 0x07>                 Tesla S/X module bus
+ *  Crc<uint8_t, 8, 0x85, CRC_NIBBLE>     Nissan Leaf LBC frames
+ *  Crc<uint8_t, 8, 0x31, CRC_NIBBLE, true> BMW SBOX (Maxim, reflected)
+ */
+#include <stdint.h>
+
+#define CRC_BYTE   false
+#define CRC_NIBBLE true
+
+namespace CrcGen
+{
+template <unsigned... I> struct Seq {};
+template <unsigned N, unsigned... I> struct MakeSeq : MakeSeq<N - 1, N - 1, I...> {};
+template <unsigned... I> struct MakeSeq<0, I...> { typedef Seq<I...> type; };
+
+template <unsigned Width> struct Mask { static constexpr uint32_t value = (Width >= 32) ? 0xffffffff : ((1UL << Width) - 1); };
+
+constexpr uint32_t Reflect(uint32_t x, unsigned bits)
+{
+    return bits == 0 ? 0 : (((x & 1) << (bits - 1)) | Reflect(x >> 1, bits - 1));
+}
+
+//Shift n bits through the register, most significant bit first
+template <unsigned Width>
+constexpr uint32_t ShiftMsb(uint32_t r, uint32_t poly, unsigned n)
+{
+    return n == 0 ? r : ShiftMsb<Width>(((r >> (Width - 1)) & 1 ? (r << 1) ^ poly : r << 1) & Mask<Width>::value, poly, n - 1);
+}
+
+//Shift n bits through the register, least significant bit first, poly is reflected
+constexpr uint32_t ShiftLsb(uint32_t r, uint32_t poly, unsigned n)
+{
+    return n == 0 ? r : ShiftLsb((r & 1) ? (r >> 1) ^ poly : r >> 1, poly, n - 1);
+}
+
+template <typename T, unsigned Width, uint32_t Poly, unsigned Bits, bool Reflected>
+constexpr T Entry(unsigned i)
+{
+    return Reflected ? (T)ShiftLsb(i, Reflect(Poly, Width), Bits)
+                     : (T)ShiftMsb<Width>((uint32_t)i << (Width - Bits), Poly, Bits);
+}
+
+template <typename T, unsigned Width, uint32_t Poly, unsigned Bits, bool Reflected, typename S> struct Table;
+
+template <typename T, unsigned Width, uint32_t Poly, unsigned Bits, bool Reflected, unsigned... I>
+struct Table<T, Width, Poly, Bits, Reflected, Seq<I...> >
+{
+    static constexpr T data[sizeof...(I)] = { Entry<T, Width, Poly, Bits, Reflected>(I)... };
+};
+
+template <typename T, unsigned Width, uint32_t Poly, unsigned Bits, bool Reflected, unsigned... I>
+constexpr T Table<T, Width, Poly, Bits, Reflected, Seq<I...> >::data[sizeof...(I)];
+}
+
+template <typename T, unsigned Width, uint32_t Poly, bool Nibble = CRC_BYTE, bool Reflected = false>
+class Crc
+{
+public:
+    static_assert(Width >= 8 && Width <= sizeof(T) * 8, "CRC register must hold whole bytes");
+
+    //Run len bytes through the register and return the new register
+    static T Update(T crc, const uint8_t* data, int len)
+    {
+        while (len-- > 0)
+        {
+            crc = Byte(crc, *data++);
+        }
+        return crc;
+    }
+
+    static T Calc(const uint8_t* data, int len, T init = 0)
+    {
+        return Update(init, data, len);
+    }
+
+    //Run the top "bits" bits of inB through the register, for frames that are not whole bytes
+    static T Bits(T crc, uint8_t inB, uint8_t bits)
+    {
+        uint32_t r = crc ^ ((uint32_t)(inB & (uint8_t)(0xff00 >> bits)) << (Width - 8));
+
+        return (T)CrcGen::ShiftMsb<Width>(r, Poly, bits);
+    }
+
+private:
+    typedef CrcGen::Table<T, Width, Poly, Nibble ? 4 : 8, Reflected, typename CrcGen::MakeSeq<Nibble ? 16 : 256>::type> Tab;
+
+    static T Byte(T crc, uint8_t b)
+    {
+        const uint32_t mask = CrcGen::Mask<Width>::value;
+
+        if (Reflected)
+        {
+            if (Nibble)
+            {
+                crc = (crc >> 4) ^ Tab::data[(crc ^ b) & 0xf];
+                return (crc >> 4) ^ Tab::data[(crc ^ (b >> 4)) & 0xf];
+            }
+            return (T)((crc >> 8) ^ Tab::data[(crc ^ b) & 0xff]);
+        }
+        if (Nibble)
+        {
+            crc = (T)(((uint32_t)crc << 4) & mask) ^ Tab::data[((crc >> (Width - 4)) ^ (b >> 4)) & 0xf];
+            return (T)(((uint32_t)crc << 4) & mask) ^ Tab::data[((crc >> (Width - 4)) ^ b) & 0xf];
+        }
+        return (T)(((uint32_t)crc << 8) & mask) ^ Tab::data[((crc >> (Width - 8)) ^ b) & 0xff];
+    }
+};
+
+#endif /* CRC_h */
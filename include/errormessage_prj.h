@@ -6,5 +6,7 @@
 #define ERROR_MESSAGE_LIST \
    ERROR_MESSAGE_ENTRY(TESTERROR, ERROR_STOP) \
    ERROR_MESSAGE_ENTRY(CANTIMEOUT, ERROR_STOP) \
+   ERROR_MESSAGE_ENTRY(BMBCOUNT, ERROR_STOP) \
+   ERROR_MESSAGE_ENTRY(MODULELOST, ERROR_STOP) \
 
 #endif // ERRORMESSAGE_PRJ_H_INCLUDED
@@ -14,6 +14,9 @@
 #define PARAM_BLKNUM  1   //last block of 1k
 #define CAN1_BLKNUM   2
 #define CAN2_BLKNUM   4
+#define COULOMB_BLKNUM 5  //coulomb counter log, below the CAN maps
+#define OCV_BLKNUM     6  //user OCV curves
+#define COULOMB_BLKNUM2 7 //second coulomb log page, written alternately with COULOMB_BLKNUM
 
 
 #endif // HWDEFS_H_INCLUDED
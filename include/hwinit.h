@@ -30,6 +30,7 @@ void clock_setup(void);
 void nvic_setup(void);
 void rtc_setup(void);
 void tim3_setup(void);
+void tim4_setup(void);
 void spi1_setup(void);
 void usart1_setup(void);
 void write_bootloader_pininit();
@@ -51,6 +51,8 @@ public:
     static void RESTART(CanHardware* can);
     static void deFAULT(CanHardware* can);
     static void DecodeCAN(int id, uint32_t data[2]);
+    static void Task10Ms();
+    static bool IsBusy();
 
     static int32_t Voltage;
     static int32_t Voltage2;
@@ -63,6 +65,8 @@ public:
 
 
 private:
+    static void Queue(CanHardware* can, uint8_t cmd, uint8_t b1, uint8_t b2, uint8_t b3);
+    static void handle511(uint32_t data[2]);
     static void handle521(uint32_t data[2]);
     static void handle522(uint32_t data[2]);
     static void handle523(uint32_t data[2]);
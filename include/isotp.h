@@ -0,0 +1,59 @@
+/*
+ * This file is part of the RaVus BMS project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ISOTP_H
+#define ISOTP_H
+
+/*  ISO 15765-2 (ISO-TP) transport for one diagnostic request/reply channel.
+ *
+ *  Send() segments a request into single, first and consecutive frames.
+ *  Replies are reassembled straight into a static buffer, the caller
+ *  decodes them in place from GetData() and calls Release() when done.
+ *  Flow control is answered with the block size and separation time set
+ *  by SetFlowControl(), which is how the caller paces the other node.
+ *  Tick() must be called periodically for timeouts and transmit pacing.
+ *  All frames are padded to 8 bytes with 0xFF.
+ */
+
+#include <stdint.h>
+#include "canhardware.h"
+
+#define ISOTP_MAX_LEN        256   // largest Leaf LBC reply is 198 bytes
+
+class IsoTp
+{
+public:
+    enum Status { ISOTP_IDLE, ISOTP_BUSY, ISOTP_DONE, ISOTP_ERROR };
+
+    static void Init(CanHardware* can, uint32_t txId, uint32_t rxId);
+    static bool Send(const uint8_t* data, uint16_t len);
+    static void HandleRx(uint32_t data[2]);
+    static void Tick(int ms);
+    static void SetFlowControl(uint8_t blockSize, uint8_t stMinMs);
+    static Status GetStatus();
+    static const uint8_t* GetData();
+    static uint16_t GetLength();
+    static void Release();
+    static uint16_t TakeFrameCount();
+
+private:
+    static void SendFrame(const uint8_t* frame);
+    static void SendFlowControl(uint8_t flag);
+    static void SendConsecutive();
+};
+
+#endif // ISOTP_H
@@ -28,8 +28,13 @@ class LeafBMS
 public:
     static void RegisterCanMessages(CanHardware* can);
 	static void DecodeCAN(int id, uint32_t data[2]);
+    static void Task10Ms();
 private:
     static bool isMessageCorrupt(uint8_t *data);
+    static void DecodeGroup(const uint8_t* data, uint16_t len);
+    static void DecodeCells(const uint8_t* data, uint16_t len);
+    static void DecodeTemps(const uint8_t* data, uint16_t len);
+    static void DecodeShunts(const uint8_t* data, uint16_t len);
 };
 
 #endif // LEAFBMS_H
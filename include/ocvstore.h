@@ -0,0 +1,59 @@
+/*
+ * This file is part of the RaVus BMS project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCVSTORE_H
+#define OCVSTORE_H
+
+/*  OCV/SOC curves, picked with the Chemistry parameter.
+ *
+ *  NMC and LFP are built in. "User" uses up to OCV_SLOTS curves kept on
+ *  their own flash page, each valid from its tMin upwards, so a pack can
+ *  have one curve per temperature band. They are uploaded over CAN SDO:
+ *
+ *  0x4010.0  W  start a curve in the staging buffer, data = tMin | points << 8
+ *  0x4010.1  W  copy flash slot <data> into the staging buffer
+ *  0x4011.n  RW point n, data = SOC in 0.01% (up to 10000) | mV << 16
+ *  0x4012.n  RW point n dU/dT in uV/K
+ *  0x4013.s  W  write the staging buffer to flash slot s, 0xFF erases all slots
+ *  0x4014.s  R  tMin | points << 8 of flash slot s
+ *
+ *  Points must be ascending in both SOC and voltage, so both lookups can
+ *  binary search the same table.
+ */
+
+#include <stdint.h>
+#include "socekf.h"
+#include "cansdo.h"
+
+#define OCV_SLOTS            4
+#define OCV_MAX_POINTS       24
+
+class OcvStore
+{
+public:
+    enum { CHEM_NMC, CHEM_LFP, CHEM_USER };
+
+    static void Init();
+    static const SocEkf::OcvPoint* GetCurve(int tempC, int* points);
+    static int32_t SocFromVoltage(int mv, int tempC);
+    static void HandleSdo(CanSdo::SdoFrame* sdo);
+
+private:
+    static bool StoreSlot(int slot);
+};
+
+#endif // OCVSTORE_H
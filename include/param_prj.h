@@ -46,12 +46,12 @@
    2. Temporary parameters (id = 0)
    3. Display values
  */
-//Next param id (increase when adding new parameter!): 15
-//Next value Id: 2182
+//Next param id (increase when adding new parameter!): 43
+//Next value Id: 2318
 /*      category     			name         	unit       min     	max     default id */
 #define PARAM_LIST \
     PARAM_ENTRY(CAT_BMS,     	bmstype,      	TYPES,		0,     	3,      0,     	1 )\
-    PARAM_ENTRY(CAT_BMS,     	numbmbs,     	"",       	1,      20,     4,      2 )\
+    PARAM_ENTRY(CAT_BMS,     	numbmbs,     	"",       	1,      4,      4,      2 )\
     PARAM_ENTRY(CAT_BMS,     	balance,     	OFFON,     	0,      1,      0,      3 )\
 	PARAM_ENTRY(CAT_BMS,     	Vbalance,     	"mV",     	3500,   4200,   3900,   4 )\
     PARAM_ENTRY(CAT_BMS,     	BattCap,     	"kWh",     	1,    	250,    22,     5 )\
@@ -61,6 +61,19 @@
 	PARAM_ENTRY(CAT_BMS,     	IDCmin,     	"A",      	-1500, 	0,   	-500,   9 )\
     PARAM_ENTRY(CAT_BMS,     	CellTmax,     	"C",      	25, 	65,   	40,   	10)\
     PARAM_ENTRY(CAT_BMS,     	CellTmin,     	"C",      	-20, 	25,   	5,   	11)\
+    PARAM_ENTRY(CAT_BMS,     	ScanTime,     	"ms",      	60, 	5000,  	3000,  	30)\
+    PARAM_ENTRY(CAT_BMS,     	BcastAdc,     	OFFON,     	0,      1,      1,      31)\
+    PARAM_ENTRY(CAT_BMS,     	StatPoll,     	"",       	1,      100,    10,     32)\
+    PARAM_ENTRY(CAT_BMS,     	PecCheck,     	OFFON,     	0,      1,      1,      41)\
+    PARAM_ENTRY(CAT_COMM,    	DiagLoad,     	"%",       	1,      20,     2,      33)\
+    PARAM_ENTRY(CAT_SOC,     	CellR0,     	"mOhm",    	0,      100,    1,      34)\
+    PARAM_ENTRY(CAT_SOC,     	CellR1,     	"mOhm",    	0,      100,    1,      35)\
+    PARAM_ENTRY(CAT_SOC,     	CellTau,     	"s",       	1,      3600,   30,     36)\
+    PARAM_ENTRY(CAT_SOC,     	EkfQsoc,     	"ppm",     	0,      10000,  20,     37)\
+    PARAM_ENTRY(CAT_SOC,     	EkfQrc,     	"mV",      	0,      100,    0.5,    38)\
+    PARAM_ENTRY(CAT_SOC,     	EkfR,     		"mV",      	2,      100,    10,     39)\
+    PARAM_ENTRY(CAT_SOC,     	Chemistry,     	CHEMS,     	0,      2,      0,      40)\
+    PARAM_ENTRY(CAT_SOC,     	CellAh,     	"Ah",      	1,      1000,   60,     42)\
 	PARAM_ENTRY(CAT_ALRM,    	VOffset,     	"mV",      	0, 		500,   	100,   	12)\
 	PARAM_ENTRY(CAT_ALRM,    	Vdelta,     	"mV",      	0, 		500,   	100,   	13)\
 	PARAM_ENTRY(CAT_ALRM,    	Vignore,     	"mV",      	0, 		1000,   500,   	14)\
@@ -114,6 +127,8 @@
 	VALUE_ENTRY(umin,        	"mV",   	2031 ) \
     VALUE_ENTRY(umax,        	"mV",   	2032 ) \
 	VALUE_ENTRY(uavg,        	"mV",   	2033 ) \
+    VALUE_ENTRY(umaxcell,    	"",   		2290 ) \
+    VALUE_ENTRY(umincell,    	"",   		2291 ) \
 	VALUE_ENTRY(deltaV,      	"mV",   	2034 ) \
     VALUE_ENTRY(TempMax,     	"°C",   	2035 ) \
     VALUE_ENTRY(TempMin,     	"°C",   	2036 ) \
@@ -306,7 +321,43 @@
     VALUE_ENTRY(ChipV5,       	"V",   		2274 ) \
     VALUE_ENTRY(ChipV6,       	"V",   		2275 ) \
     VALUE_ENTRY(ChipV7,       	"V",   		2278 ) \
-    VALUE_ENTRY(ChipV8,       	"V",   		2279 ) 
+    VALUE_ENTRY(ChipV8,       	"V",   		2279 ) \
+    VALUE_ENTRY(Bmb1Good,     	"",   		2280 ) \
+    VALUE_ENTRY(Bmb2Good,     	"",   		2281 ) \
+    VALUE_ENTRY(Bmb3Good,     	"",   		2282 ) \
+    VALUE_ENTRY(Bmb4Good,     	"",   		2283 ) \
+    VALUE_ENTRY(Bmb1Bad,      	"",   		2284 ) \
+    VALUE_ENTRY(Bmb2Bad,      	"",   		2285 ) \
+    VALUE_ENTRY(Bmb3Bad,      	"",   		2286 ) \
+    VALUE_ENTRY(Bmb4Bad,      	"",   		2287 ) \
+    VALUE_ENTRY(PecRetries,   	"",   		2288 ) \
+    VALUE_ENTRY(ChipsFound,   	"",   		2289 ) \
+    VALUE_ENTRY(PecBadPct,    	"%",   		2315 ) \
+    VALUE_ENTRY(PecWorst,     	"",   		2316 ) \
+    VALUE_ENTRY(TslaGood,     	"",   		2292 ) \
+    VALUE_ENTRY(TslaBad,      	"",   		2293 ) \
+    VALUE_ENTRY(TslaCrcErr,   	"",   		2294 ) \
+    VALUE_ENTRY(TslaTimeout,  	"",   		2295 ) \
+    VALUE_ENTRY(TslaRetries,  	"",   		2296 ) \
+    VALUE_ENTRY(TslaWorst,    	"",   		2297 ) \
+    VALUE_ENTRY(TslaLatency,  	"us",   	2317 ) \
+    VALUE_ENTRY(TslaModules,  	"",   		2298 ) \
+    VALUE_ENTRY(LeafT1,       	"°C",   	2299 ) \
+    VALUE_ENTRY(LeafT2,       	"°C",   	2300 ) \
+    VALUE_ENTRY(LeafT3,       	"°C",   	2301 ) \
+    VALUE_ENTRY(LeafT4,       	"°C",   	2302 ) \
+    VALUE_ENTRY(LeafShunt1,   	"",   		2303 ) \
+    VALUE_ENTRY(LeafShunt2,   	"",   		2304 ) \
+    VALUE_ENTRY(LeafShunt3,   	"",   		2305 ) \
+    VALUE_ENTRY(LeafShunt4,   	"",   		2306 ) \
+    VALUE_ENTRY(AhChg,        	"Ah",   	2307 ) \
+    VALUE_ENTRY(AhDis,        	"Ah",   	2308 ) \
+    VALUE_ENTRY(kWhChg,       	"kWh",  	2309 ) \
+    VALUE_ENTRY(kWhDis,       	"kWh",  	2310 ) \
+    VALUE_ENTRY(CoulGaps,     	"",   		2311 ) \
+    VALUE_ENTRY(EkfInnov,     	"mV",   	2312 ) \
+    VALUE_ENTRY(EkfCycles,    	"",   		2313 ) \
+    VALUE_ENTRY(OcvCurves,    	"",   		2314 )
 
 
 
@@ -316,11 +367,13 @@
 #define OFFON        "0=Off, 1=On"
 #define BAL          "0=None, 1=Discharge"
 #define TYPES        "0=Model_3, 1=Model_S, 2=BMW_PHEV, 3=Nissan_Leaf"
+#define CHEMS        "0=NMC, 1=LFP, 2=User"
 #define CAT_BMS      "Battery Management Settings"
 #define CAT_ALRM     "Warning & Alarm Settings"
 #define CAT_SENS     "Current Sensor setup"
 #define CAT_COMM     "Communication"
 #define CAT_PWM      "PWM Control"
+#define CAT_SOC      "SOC Estimation"
 #define FREQLow      "0=1Hz, 1=2Hz, 2=10Hz"
 #define FREQ         "3=100Hz, 4=500Hz, 5=1kHz, 6=10kHz, 7=100kHz"
 
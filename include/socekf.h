@@ -0,0 +1,86 @@
+/*
+ * This file is part of the RaVus BMS project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SOCEKF_H
+#define SOCEKF_H
+
+/*  Extended Kalman filter SOC estimator, integer only.
+ *
+ *  State is SOC and the voltage over a single RC pair:
+ *     soc'  = soc + dSoc                      (from the coulomb counter)
+ *     vrc'  = a * vrc + (1 - a) * R1 * I      a = exp(-dt / tau)
+ *     vcell = OCV(soc, T) + vrc + R0 * I
+ *  OCV is a table at 25°C plus an entropic term dU/dT * (T - 25).
+ *
+ *  Units: SOC in ppm (1000000 = 100%), voltages in uV, current in mA
+ *  (positive charges the cell), resistances in uOhm, times in ms.
+ *  Covariances are int64 in those units, gains Q16. Each step is a fixed
+ *  number of multiplies, a binary search of the OCV table and four 64 bit
+ *  divides: two in Ocv() for the segment fraction and slope, two in
+ *  Update() for the gains. Predict() adds one more for exp(-dt / tau), only
+ *  when dt or tau changed since the last step. No floating point. It
+ *  depends on nothing but stdint.h so it builds on the host too.
+ */
+
+#include <stdint.h>
+
+class SocEkf
+{
+public:
+    struct OcvPoint
+    {
+        int32_t soc;    // ppm, ascending
+        int16_t mv;     // OCV at 25°C
+        int16_t dudt;   // uV/K
+    };
+
+    struct Model
+    {
+        int32_t r0;     // uOhm
+        int32_t r1;     // uOhm
+        int32_t tau;    // ms
+        int32_t qSoc;   // process noise per step, ppm
+        int32_t qRc;    // process noise per step, uV
+        int32_t rMeas;  // measurement noise, uV
+        const OcvPoint* ocv;
+        int ocvPoints;
+    };
+
+    static const OcvPoint defaultOcv[];
+    static const int defaultOcvPoints;
+
+    void Init(const Model& m, int32_t soc, int32_t socStd);
+    void SetModel(const Model& m);
+    void Predict(int32_t dSoc, int32_t milliAmps, int32_t dtMs);
+    void Update(int32_t cellMv, int32_t milliAmps, int tempC);
+    int32_t GetSoc() const { return soc; }
+    int32_t GetInnovation() const { return innovation; }
+    int32_t Ocv(int32_t soc, int tempC, int32_t* slope) const;
+    static int FindSegment(const OcvPoint* t, int points, int32_t soc);
+
+private:
+    Model model;
+    int32_t soc;
+    int32_t vrc;
+    int64_t p11, p12, p22;
+    int32_t decay;      // Q16, exp(-dt / tau) for decayDt
+    int32_t decayDt;
+    int32_t decayTau;
+    int32_t innovation;
+};
+
+#endif // SOCEKF_H
@@ -6,147 +6,234 @@
  * SOC calculation + Tesla BMS protocol functions
  */
 #include "BMSUtil.h"
-#include "delay.h"
+#include "crc.h"
+#include "coulomb.h"
+#include "socekf.h"
+#include "ocvstore.h"
 #include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/cm3/dwt.h>
 
 /* -----------------------------------------------------------------------
- * SOC calculation (existing code)
+ * SOC calculation
+ * The EKF in socekf.cpp runs on the lowest cell every 100 ms, fed with
+ * the coulomb counter's charge. The OCV curve comes from OcvStore for the
+ * selected chemistry, its reverse lookup only seeds the EKF once when
+ * there is no stored SOC.
  * ----------------------------------------------------------------------- */
-//voltage to state of charge                0%    10%   20%   30%   40%   50%   60%   70%   80%   90%   100%
-uint16_t voltageToSoc[] = { 3300, 3400, 3450, 3500, 3560, 3600, 3700, 3800, 4000, 4100, 4200 };
 
-uint16_t TempSOC = 0;
-uint32_t NoCurCounter = 0;
-uint32_t NoCurRun = 20;
-float NoCurLim = 1.0;
-float asDiff = 0;
+#define SOC_STEP_MS          100
+#define SOC_SEED_STD         100000 // 10% in ppm
+#define SOC_TABLE_STD        200000 // 20% when seeded from the voltage table
+
+static SocEkf socEkf;
+static bool socStarted = false;
 
 void BMSUtil::UpdateSOC()
 {
-    TempSOC = Param::GetInt(Param::SOC);
-
-    if(ABS(Param::GetFloat(Param::idc)) < NoCurLim)
-    {
-        NoCurCounter++;
-    }
-    else
+    int cellMv = Param::GetInt(Param::umin);
+
+    //no cell data yet, leave the charge in the counter until the filter can take it
+    if (cellMv <= 0) return;
+
+    //1 ppm of the series string's capacity in nC, so the remainder stays in the counter
+    int32_t dSoc = CoulombCounter::TakeCharge((int64_t)Param::GetInt(Param::CellAh) * 3600000);
+    int32_t milliAmps = FP_TOINT(Param::Get(Param::idc) * 1000);
+    int tempC = Param::GetInt(Param::Tempavg);
+    SocEkf::Model model;
+
+    model.r0 = FP_TOINT(Param::Get(Param::CellR0) * 1000);
+    model.r1 = FP_TOINT(Param::Get(Param::CellR1) * 1000);
+    model.tau = Param::GetInt(Param::CellTau) * 1000;
+    model.qSoc = Param::GetInt(Param::EkfQsoc);
+    model.qRc = FP_TOINT(Param::Get(Param::EkfQrc) * 1000);
+    model.rMeas = FP_TOINT(Param::Get(Param::EkfR) * 1000);
+    model.ocv = OcvStore::GetCurve(tempC, &model.ocvPoints);
+
+    if (!socStarted)
     {
-        NoCurCounter=0;
+        //SOC restored by the coulomb counter, else a rough guess from the table
+        if (Param::GetInt(Param::SOC) > 0)
+            socEkf.Init(model, Param::Get(Param::SOC) * 10000 / FP_FROMINT(1), SOC_SEED_STD);
+        else
+            socEkf.Init(model, OcvStore::SocFromVoltage(cellMv, tempC), SOC_TABLE_STD);
+        socStarted = true;
     }
 
-    if(NoCurCounter > NoCurRun)
-    {
-        TempSOC=EstimateSocFromVoltage();
-    }
-    else
-    {
-        TempSOC = TempSOC + (100 * asDiff / (3600 * Param::GetInt(Param::BattCap)));
-    }
+    uint32_t start = dwt_read_cycle_counter();
+
+    socEkf.SetModel(model);
+    socEkf.Predict(dSoc, milliAmps, SOC_STEP_MS);
+    socEkf.Update(cellMv, milliAmps, tempC);
 
-    Param::SetInt(Param::SOC,TempSOC);
+    Param::SetInt(Param::EkfCycles, dwt_read_cycle_counter() - start);
+    Param::SetFixed(Param::EkfInnov, FP_FROMINT(socEkf.GetInnovation()) / 1000);
+    Param::SetFixed(Param::SOC, FP_FROMINT(socEkf.GetSoc() / 10000) + FP_FROMINT(socEkf.GetSoc() % 10000) / 10000);
 }
 
 int BMSUtil::EstimateSocFromVoltage()
 {
-    float lowestVoltage = Param::GetFloat(Param::umin);
-    int n = sizeof(voltageToSoc) / sizeof(voltageToSoc[0]);
-
-    for (int i = 0; i < n; i++)
-    {
-        if (lowestVoltage < voltageToSoc[i])
-        {
-            if (i == 0) return 0;
-
-            float soc = i * 10;
-            float lutDiff = voltageToSoc[i] - voltageToSoc[i - 1];
-            float valDiff = voltageToSoc[i] - lowestVoltage;
-            //interpolate
-            soc -= (valDiff / lutDiff) * 10;
-            return soc;
-        }
-    }
-    return 100;
+    return OcvStore::SocFromVoltage(Param::GetInt(Param::umin), Param::GetInt(Param::Tempavg)) / 10000;
 }
 
 /* -----------------------------------------------------------------------
  * Tesla BMS protocol (new code)
  * USART1 @ 612500 baud, initialized in hwinit.cpp
+ * TX goes out on DMA1 channel 4, RX runs continuously on DMA1 channel 5
+ * into a ring buffer. A reply is complete once the expected length is in
+ * or the line went idle after at least one byte. The idle interrupt only
+ * timestamps the end of the reply, the manager turns that into its reply
+ * window.
  * ----------------------------------------------------------------------- */
-#define BMS_BYTE_TIMEOUT_US  5000  // 5 ms timeout per byte
+#define BMS_RX_RING          64    // power of two, longer than any reply
+#define BMS_TX_MAX           32
 
-uint8_t BMSUtil::GenCRC(uint8_t *input, int lenInput)
+typedef Crc<uint8_t, 8, 0x07> TeslaCrc;
+
+static uint8_t RxRing[BMS_RX_RING];
+static uint8_t RxTail = 0;
+static uint8_t TxBuf[BMS_TX_MAX];
+static uint32_t txStart = 0;      // cycle counter when the last request went out
+static volatile uint32_t rxIdleAt = 0;
+static volatile bool rxIdle = false;
+
+void BMSUtil::UartStart()
+{
+    dma_channel_reset(DMA1, DMA_CHANNEL4);
+    dma_set_peripheral_address(DMA1, DMA_CHANNEL4, (uint32_t)&USART1_DR);
+    dma_set_memory_address(DMA1, DMA_CHANNEL4, (uint32_t)TxBuf);
+    dma_set_read_from_memory(DMA1, DMA_CHANNEL4);
+    dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL4);
+    dma_set_peripheral_size(DMA1, DMA_CHANNEL4, DMA_CCR_PSIZE_8BIT);
+    dma_set_memory_size(DMA1, DMA_CHANNEL4, DMA_CCR_MSIZE_8BIT);
+    usart_enable_tx_dma(USART1);
+
+    dma_channel_reset(DMA1, DMA_CHANNEL5);
+    dma_set_peripheral_address(DMA1, DMA_CHANNEL5, (uint32_t)&USART1_DR);
+    dma_set_memory_address(DMA1, DMA_CHANNEL5, (uint32_t)RxRing);
+    dma_set_number_of_data(DMA1, DMA_CHANNEL5, BMS_RX_RING);
+    dma_set_read_from_peripheral(DMA1, DMA_CHANNEL5);
+    dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL5);
+    dma_enable_circular_mode(DMA1, DMA_CHANNEL5);
+    dma_set_peripheral_size(DMA1, DMA_CHANNEL5, DMA_CCR_PSIZE_8BIT);
+    dma_set_memory_size(DMA1, DMA_CHANNEL5, DMA_CCR_MSIZE_8BIT);
+    dma_enable_channel(DMA1, DMA_CHANNEL5);
+    usart_enable_rx_dma(USART1);
+
+    dwt_enable_cycle_counter();
+    usart_enable_idle_interrupt(USART1);
+}
+
+void BMSUtil::UartInterrupt()
 {
-    uint8_t crc = 0;
-    for (int x = 0; x < lenInput; x++) {
-        crc ^= input[x];
-        for (int i = 0; i < 8; i++)
-            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (crc << 1);
+    //SR then DR read clears the flag, the data itself already went to the DMA
+    if (USART_SR(USART1) & USART_SR_IDLE)
+    {
+        (void)USART_DR(USART1);
+        rxIdleAt = dwt_read_cycle_counter();
+        rxIdle = true;
     }
-    return crc;
 }
 
-void BMSUtil::SendData(uint8_t *data, uint8_t dataLen, bool isWrite)
+extern "C" void usart1_isr(void)
 {
-    uint8_t orig     = data[0];
-    uint8_t addrByte = data[0];
-    if (isWrite) addrByte |= 1;
+    BMSUtil::UartInterrupt();
+}
 
-    /* Flush stale RX */
-    while (USART_SR(USART1) & USART_SR_RXNE)
-        (void)usart_recv(USART1);
+static uint8_t RxHead()
+{
+    return (BMS_RX_RING - dma_get_number_of_data(DMA1, DMA_CHANNEL5)) & (BMS_RX_RING - 1);
+}
 
-    usart_send_blocking(USART1, addrByte);
-    for (int i = 1; i < dataLen; i++)
-        usart_send_blocking(USART1, data[i]);
+int BMSUtil::RxAvailable()
+{
+    return (RxHead() - RxTail) & (BMS_RX_RING - 1);
+}
 
-    data[0] = addrByte;
-    if (isWrite)
-        usart_send_blocking(USART1, GenCRC(data, dataLen));
+bool BMSUtil::ReplyComplete(int expected)
+{
+    int avail = RxAvailable();
+
+    return avail >= expected || (avail > 0 && rxIdle);
+}
 
-    data[0] = orig;
+/** Time from the last request going out until the line went idle after the reply, -1 if it hasn't yet */
+int BMSUtil::ReplyTimeUs()
+{
+    if (!rxIdle) return -1;
+    return (rxIdleAt - txStart) / (rcc_ahb_frequency / 1000000);
 }
 
-int BMSUtil::GetReply(uint8_t *data, int maxLen)
+int BMSUtil::ReadReply(uint8_t *data, int maxLen)
 {
     int numBytes = 0;
 
-    while (numBytes < maxLen) {
-        uint32_t timeoutStart = 0;
-        bool got = false;
-        
-        /* Simple polling with timeout (~5ms per byte) */
-        for (uint32_t t = 0; t < BMS_BYTE_TIMEOUT_US; t++) {
-            if (USART_SR(USART1) & USART_SR_RXNE) {
-                data[numBytes] = (uint8_t)usart_recv(USART1);
-                got = true;
-                break;
-            }
-            uDelay(1);  // 1 µs delay from libopeninv/delay.h
-        }
-        
-        if (!got) break;
-        numBytes++;
+    while (numBytes < maxLen && RxTail != RxHead())
+    {
+        data[numBytes++] = RxRing[RxTail];
+        RxTail = (RxTail + 1) & (BMS_RX_RING - 1);
     }
 
-    /* Drain overflow */
-    while (USART_SR(USART1) & USART_SR_RXNE)
-        (void)usart_recv(USART1);
+    /* Drop the rest, a reply never spans two requests */
+    RxTail = RxHead();
 
     return numBytes;
 }
 
-int BMSUtil::SendDataWithReply(uint8_t *data, uint8_t dataLen, bool isWrite,
-                                uint8_t *retData, int retLen)
+uint8_t BMSUtil::GenCRC(uint8_t *input, int lenInput)
+{
+    return TeslaCrc::Calc(input, lenInput);
+}
+
+void BMSUtil::SendData(uint8_t *data, uint8_t dataLen, bool isWrite)
+{
+    if (dataLen + 1 > BMS_TX_MAX) return;
+
+    /* Previous frame must be out of the DMA before the buffer is reused */
+    while ((DMA1_CCR4 & DMA_CCR_EN) && dma_get_number_of_data(DMA1, DMA_CHANNEL4) > 0);
+    dma_disable_channel(DMA1, DMA_CHANNEL4);
+
+    TxBuf[0] = data[0];
+    if (isWrite) TxBuf[0] |= 1;
+    for (int i = 1; i < dataLen; i++)
+        TxBuf[i] = data[i];
+
+    if (isWrite)
+    {
+        TxBuf[dataLen] = GenCRC(TxBuf, dataLen);
+        dataLen++;
+    }
+
+    /* Flush stale RX and the idle flag (SR then DR read clears it) */
+    RxTail = RxHead();
+    (void)USART_SR(USART1);
+    (void)USART_DR(USART1);
+    rxIdle = false;
+
+    dma_clear_interrupt_flags(DMA1, DMA_CHANNEL4, DMA_TCIF);
+    dma_set_number_of_data(DMA1, DMA_CHANNEL4, dataLen);
+    txStart = dwt_read_cycle_counter();
+    dma_enable_channel(DMA1, DMA_CHANNEL4);
+}
+
+int BMSUtil::CheckReply(const uint8_t *data, int len, int expected)
+{
+    if (len != expected) return REPLY_TIMEOUT;
+    if (data[len - 1] != GenCRC((uint8_t*)data, len - 1)) return REPLY_CRC;
+    return REPLY_OK;
+}
+
+/** Count one attempt, final is false when it is going to be retried */
+void BMSUtil::CountReply(LinkStats *stats, int result, bool final)
 {
-    int attempts = 1, returnedLength = 0;
-    
-    while (attempts < 4) {
-        SendData(data, dataLen, isWrite);
-        uDelay(2000 * ((retLen / 8) + 1));  // 2ms * frame size
-        returnedLength = GetReply(retData, retLen);
-        if (returnedLength == retLen) return returnedLength;
-        attempts++;
+    if (result == REPLY_OK)
+    {
+        stats->good++;
+        return;
     }
-    
-    return returnedLength;
+    if (result == REPLY_CRC) stats->crcErrors++;
+    else                     stats->timeouts++;
+    if (final) stats->bad++;
+    else       stats->retries++;
 }
@@ -1,4 +1,7 @@
 #include "BatMan.h"
+#include "errormessage.h"
+#include "crc.h"
+#include "bmbpec.h"
 
 /*
 This library supports SPI communication for the Tesla Model 3 BMB (battery managment boards) "Batman" chip
@@ -29,8 +32,29 @@ Tom de Bree - Volt Influx
 Damien Mcguire - EV Bmw
 */
 
-#define cycletime 20
-float BalHys = 20; //mV balance limit
+#define BMB_TICK_MS      10 //loop() call period
+#define BMB_ACTIVE_TICKS 6  //states 0-5 take one tick each
+#ifndef BMB_MAX_CHIPS
+#define BMB_MAX_CHIPS    8  //one Model 3/Y pack, 4 BMBs of two chips. Longer chains override this and raise numbmbs
+#endif
+#define BMB_MAX_STRIDE   9  //largest per chip block of a register read
+#define BMB_CMD_WORDS    2 //Command word plus PEC word
+#define BMB_FRAME_WORDS(chips) ((chips) * BMB_MAX_STRIDE / 2 + 1) //Chain frame shifted in after a read command
+#define BMB_FRAME_BYTES  (BMB_FRAME_WORDS(BMB_MAX_CHIPS) * 2)
+#define BMB_XFER_WORDS   (BMB_CMD_WORDS + BMB_FRAME_WORDS(BMB_MAX_CHIPS))
+#define BMB_TEMP_WORDS(chips) (1 + (chips) * 4) //temperature frame, one word per chip every four
+#define BMB_TX_WORDS     (BMB_MAX_CHIPS * 3 + 32) //Command words of one sequence, the config write dominates
+#define BMB_MAX_OPS      16 //Chip selected commands in one sequence
+#define BMB_MAX_READS    6  //Read frames in one sequence
+#define BMB_CHIP_CELLS   14 //cell inputs evaluated per chip
+
+#if BMB_XFER_WORDS > 255 || BMB_TX_WORDS > 255
+#error BMB_MAX_CHIPS too large for the 8 bit transfer indices
+#endif
+#define REQ_RETRY        0x80 //ReqID flag marking a re-read of a register that failed its PEC
+#define REQ_PROBE        0x01 //ReqID of the chain length probe, a config read clocked for BMB_MAX_CHIPS
+#define REG_CFG          0x50
+uint16_t BalHys = 20; //mV balance limit
 
 uint16_t WakeUp[2] = {0x2ad4, 0x0000};
 uint16_t Mute[2] = {0x20dd, 0x0000};
@@ -52,46 +76,50 @@ uint16_t cfgR[2] = {0x5000, 0x9400};
 uint16_t padding = 0x0000;
 uint16_t receive1 = 0;
 uint16_t receive2 = 0;
-float tempval1 = 0;
-float tempval2 = 0;
-float temp1 = 0;
-float temp2 = 0;
-uint8_t  Fluffer[72];
+uint8_t  Fluffer[BMB_FRAME_BYTES];
 uint8_t count1 = 0;
 uint8_t count2 = 0;
 uint8_t count3 = 0;
 uint8_t LoopTimer1 = 5;
 
-uint16_t Voltage[8][15] =
+/* SPI1 transfer engine. DMA1 channels 2/3 are taken by the USART3 terminal,
+ * so words are clocked out from the SPI1 RXNE interrupt instead. Each state
+ * queues a sequence of chip selected commands, the gaps between them are
+ * timed by TIM4 so nothing ever busy-waits. Read frames alternate between
+ * two banks so one sequence can be decoded while the next one shifts in.
+ */
+struct BmbOp
 {
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+    uint8_t   txOfs;  //first command word in SpiTx
+    uint8_t   cmdLen; //command words, the rest of the frame is padding
+    uint8_t   len;    //words clocked with CS low
+    uint16_t  gap;    //us to wait after CS goes high
+    uint16_t* rx;     //receive buffer, 0 to discard
 };
 
-uint16_t CellBalCmd[8]= {0, 0, 0, 0, 0, 0, 0, 0};
-
-uint16_t Temps   [8] = {0};
-uint16_t Temp1   [8] = {0};
-uint16_t Temp2   [8] = {0};
-uint16_t Volts5v [8] = {0};
-uint16_t ChipV   [8] = {0};
-uint16_t Cfg [8][2] =
-{
-    {0,0},
-    {0,0},
-    {0,0},
-    {0,0},
-    {0,0},
-    {0,0},
-    {0,0},
-    {0,0}
-};
+BmbOp    SeqOps[BMB_MAX_OPS];
+uint8_t  SeqLen = 0;
+uint8_t  TxLen = 0;
+uint8_t  ReadCnt = 0;
+uint16_t SpiTx[BMB_TX_WORDS] = {0};
+uint16_t SpiRx[2][BMB_MAX_READS][BMB_XFER_WORDS];
+uint8_t  SpiReq[2][BMB_MAX_READS] = {{0}};
+volatile uint8_t SeqIdx = 0;
+volatile uint8_t SpiIdx = 0;
+volatile bool SpiBusy = false;
+uint8_t RxBank = 0;
+
+uint16_t Voltage[BMB_MAX_CHIPS][15] = {{0}};
+
+uint16_t CellBalCmd[BMB_MAX_CHIPS] = {0};
+uint16_t Cells[BMB_MAX_CHIPS * BMB_CHIP_CELLS] = {0}; //present cells in spot value order
+
+uint16_t Temps   [BMB_MAX_CHIPS] = {0};
+uint16_t Temp1   [BMB_MAX_CHIPS] = {0};
+uint16_t Temp2   [BMB_MAX_CHIPS] = {0};
+uint16_t Volts5v [BMB_MAX_CHIPS] = {0};
+uint16_t ChipV   [BMB_MAX_CHIPS] = {0};
+uint16_t Cfg [BMB_MAX_CHIPS][2] = {{0}};
 
 /*
 UVAR16 TSOLO   : 4;
@@ -106,66 +134,49 @@ UVAR8  DCC8_1;
 UVAR8  DCC16_9;
 */
 
-uint16_t crcTable2f[256] =
-{
-    0x00, 0x2F, 0x5E, 0x71, 0xBC, 0x93, 0xE2, 0xCD, 0x57, 0x78, 0x09, 0x26, 0xEB, 0xC4, 0xB5, 0x9A,
-    0xAE, 0x81, 0xF0, 0xDF, 0x12, 0x3D, 0x4C, 0x63, 0xF9, 0xD6, 0xA7, 0x88, 0x45, 0x6A, 0x1B, 0x34,
-    0x73, 0x5C, 0x2D, 0x02, 0xCF, 0xE0, 0x91, 0xBE, 0x24, 0x0B, 0x7A, 0x55, 0x98, 0xB7, 0xC6, 0xE9,
-    0xDD, 0xF2, 0x83, 0xAC, 0x61, 0x4E, 0x3F, 0x10, 0x8A, 0xA5, 0xD4, 0xFB, 0x36, 0x19, 0x68, 0x47,
-    0xE6, 0xC9, 0xB8, 0x97, 0x5A, 0x75, 0x04, 0x2B, 0xB1, 0x9E, 0xEF, 0xC0, 0x0D, 0x22, 0x53, 0x7C,
-    0x48, 0x67, 0x16, 0x39, 0xF4, 0xDB, 0xAA, 0x85, 0x1F, 0x30, 0x41, 0x6E, 0xA3, 0x8C, 0xFD, 0xD2,
-    0x95, 0xBA, 0xCB, 0xE4, 0x29, 0x06, 0x77, 0x58, 0xC2, 0xED, 0x9C, 0xB3, 0x7E, 0x51, 0x20, 0x0F,
-    0x3B, 0x14, 0x65, 0x4A, 0x87, 0xA8, 0xD9, 0xF6, 0x6C, 0x43, 0x32, 0x1D, 0xD0, 0xFF, 0x8E, 0xA1,
-    0xE3, 0xCC, 0xBD, 0x92, 0x5F, 0x70, 0x01, 0x2E, 0xB4, 0x9B, 0xEA, 0xC5, 0x08, 0x27, 0x56, 0x79,
-    0x4D, 0x62, 0x13, 0x3C, 0xF1, 0xDE, 0xAF, 0x80, 0x1A, 0x35, 0x44, 0x6B, 0xA6, 0x89, 0xF8, 0xD7,
-    0x90, 0xBF, 0xCE, 0xE1, 0x2C, 0x03, 0x72, 0x5D, 0xC7, 0xE8, 0x99, 0xB6, 0x7B, 0x54, 0x25, 0x0A,
-    0x3E, 0x11, 0x60, 0x4F, 0x82, 0xAD, 0xDC, 0xF3, 0x69, 0x46, 0x37, 0x18, 0xD5, 0xFA, 0x8B, 0xA4,
-    0x05, 0x2A, 0x5B, 0x74, 0xB9, 0x96, 0xE7, 0xC8, 0x52, 0x7D, 0x0C, 0x23, 0xEE, 0xC1, 0xB0, 0x9F,
-    0xAB, 0x84, 0xF5, 0xDA, 0x17, 0x38, 0x49, 0x66, 0xFC, 0xD3, 0xA2, 0x8D, 0x40, 0x6F, 0x1E, 0x31,
-    0x76, 0x59, 0x28, 0x07, 0xCA, 0xE5, 0x94, 0xBB, 0x21, 0x0E, 0x7F, 0x50, 0x9D, 0xB2, 0xC3, 0xEC,
-    0xD8, 0xF7, 0x86, 0xA9, 0x64, 0x4B, 0x3A, 0x15, 0x8F, 0xA0, 0xD1, 0xFE, 0x33, 0x1C, 0x6D, 0x42
+/* Register decode table. A read command returns one block of "stride" bytes
+ * per chip, "words" values are taken from each block starting at "firstByte"
+ * and stored to dest[chip * destStride + n]. A register may have several rows.
+ */
+#define REG_CELLMV   0x01 //raw cell reading, scale to mV
+#define REG_BIGEND   0x02 //word is sent high byte first
+#define REG_5VSWAP   0x04 //some chips return the 5V reading byte swapped
+#define SWAP5V_CHIPS 0xA9 //chips 0, 3, 5 and 7 of every pack
+#define CELL_MV(raw) (((uint32_t)(raw) * 5243 + 0x8000) >> 16) //raw / 12.5 as 0.08 in 16.16 fixed point
+#define CHIP_MV(raw) (((uint32_t)(raw) * 32) / 25) //1.28mV per count
+#define TEMP_DECI(raw) ((int16_t)((raw) / 10) - 400) //0.01 degC with 40 degC offset to 0.1 degC
+#define MV_TO_FP(mv) (FP_FROMINT(mv) / 1000)
+#define DECI_TO_FP(d) (FP_FROMINT(d) / 10)
+
+struct BmbReg
+{
+    uint8_t   reqId;
+    uint8_t   stride;
+    uint8_t   firstByte;
+    uint8_t   words;
+    uint8_t   flags;
+    uint16_t* dest;
+    uint8_t   destStride;
 };
 
-// CRC table for Batman data
-#define crcPolyBmData 0x025b
-
-static const uint16_t crc14table[256] =
-{
-    0x0000, 0x025b, 0x04b6, 0x06ed, 0x096c, 0x0b37, 0x0dda, 0x0f81,
-    0x12d8, 0x1083, 0x166e, 0x1435, 0x1bb4, 0x19ef, 0x1f02, 0x1d59,
-    0x25b0, 0x27eb, 0x2106, 0x235d, 0x2cdc, 0x2e87, 0x286a, 0x2a31,
-    0x3768, 0x3533, 0x33de, 0x3185, 0x3e04, 0x3c5f, 0x3ab2, 0x38e9,
-    0x093b, 0x0b60, 0x0d8d, 0x0fd6, 0x0057, 0x020c, 0x04e1, 0x06ba,
-    0x1be3, 0x19b8, 0x1f55, 0x1d0e, 0x128f, 0x10d4, 0x1639, 0x1462,
-    0x2c8b, 0x2ed0, 0x283d, 0x2a66, 0x25e7, 0x27bc, 0x2151, 0x230a,
-    0x3e53, 0x3c08, 0x3ae5, 0x38be, 0x373f, 0x3564, 0x3389, 0x31d2,
-    0x1276, 0x102d, 0x16c0, 0x149b, 0x1b1a, 0x1941, 0x1fac, 0x1df7,
-    0x00ae, 0x02f5, 0x0418, 0x0643, 0x09c2, 0x0b99, 0x0d74, 0x0f2f,
-    0x37c6, 0x359d, 0x3370, 0x312b, 0x3eaa, 0x3cf1, 0x3a1c, 0x3847,
-    0x251e, 0x2745, 0x21a8, 0x23f3, 0x2c72, 0x2e29, 0x28c4, 0x2a9f,
-    0x1b4d, 0x1916, 0x1ffb, 0x1da0, 0x1221, 0x107a, 0x1697, 0x14cc,
-    0x0995, 0x0bce, 0x0d23, 0x0f78, 0x00f9, 0x02a2, 0x044f, 0x0614,
-    0x3efd, 0x3ca6, 0x3a4b, 0x3810, 0x3791, 0x35ca, 0x3327, 0x317c,
-    0x2c25, 0x2e7e, 0x2893, 0x2ac8, 0x2549, 0x2712, 0x21ff, 0x23a4,
-    0x24ec, 0x26b7, 0x205a, 0x2201, 0x2d80, 0x2fdb, 0x2936, 0x2b6d,
-    0x3634, 0x346f, 0x3282, 0x30d9, 0x3f58, 0x3d03, 0x3bee, 0x39b5,
-    0x015c, 0x0307, 0x05ea, 0x07b1, 0x0830, 0x0a6b, 0x0c86, 0x0edd,
-    0x1384, 0x11df, 0x1732, 0x1569, 0x1ae8, 0x18b3, 0x1e5e, 0x1c05,
-    0x2dd7, 0x2f8c, 0x2961, 0x2b3a, 0x24bb, 0x26e0, 0x200d, 0x2256,
-    0x3f0f, 0x3d54, 0x3bb9, 0x39e2, 0x3663, 0x3438, 0x32d5, 0x308e,
-    0x0867, 0x0a3c, 0x0cd1, 0x0e8a, 0x010b, 0x0350, 0x05bd, 0x07e6,
-    0x1abf, 0x18e4, 0x1e09, 0x1c52, 0x13d3, 0x1188, 0x1765, 0x153e,
-    0x369a, 0x34c1, 0x322c, 0x3077, 0x3ff6, 0x3dad, 0x3b40, 0x391b,
-    0x2442, 0x2619, 0x20f4, 0x22af, 0x2d2e, 0x2f75, 0x2998, 0x2bc3,
-    0x132a, 0x1171, 0x179c, 0x15c7, 0x1a46, 0x181d, 0x1ef0, 0x1cab,
-    0x01f2, 0x03a9, 0x0544, 0x071f, 0x089e, 0x0ac5, 0x0c28, 0x0e73,
-    0x3fa1, 0x3dfa, 0x3b17, 0x394c, 0x36cd, 0x3496, 0x327b, 0x3020,
-    0x2d79, 0x2f22, 0x29cf, 0x2b94, 0x2415, 0x264e, 0x20a3, 0x22f8,
-    0x1a11, 0x184a, 0x1ea7, 0x1cfc, 0x137d, 0x1126, 0x17cb, 0x1590,
-    0x08c9, 0x0a92, 0x0c7f, 0x0e24, 0x01a5, 0x03fe, 0x0513, 0x0748
+static const BmbReg BmbRegs[] =
+{
+    //req   stride first words flags        destination    destStride
+    { 0x47, 9,     0,    3,    REG_CELLMV,  &Voltage[0][0],  15 }, //Read A, cells 1-3
+    { 0x48, 9,     0,    3,    REG_CELLMV,  &Voltage[0][3],  15 }, //Read B, cells 4-6
+    { 0x49, 9,     0,    3,    REG_CELLMV,  &Voltage[0][6],  15 }, //Read C, cells 7-9
+    { 0x4A, 9,     0,    3,    REG_CELLMV,  &Voltage[0][9],  15 }, //Read D, cells 10-12
+    { 0x4B, 9,     0,    3,    REG_CELLMV,  &Voltage[0][12], 15 }, //Read E, cells 13-15
+    { 0x4C, 7,     2,    1,    0,           ChipV,           1  }, //Read F, chip total voltage
+    { 0x4D, 9,     0,    1,    0,           Temp1,           1  }, //Aux A, cell temperature 1
+    { 0x4D, 9,     2,    1,    REG_5VSWAP,  Volts5v,         1  }, //Aux A, 5V regulator
+    { 0x4D, 9,     4,    1,    0,           Temp2,           1  }, //Aux A, cell temperature 2
+    { 0x50, 7,     0,    2,    REG_BIGEND,  &Cfg[0][0],      2  }, //Config
 };
 
-const uint8_t utilTopN[9] = { 0x00, 0x80, 0xc0, 0xe0, 0xf0, 0xf8, 0xfc, 0xfe, 0xff };
+#define REG_COUNT (sizeof(BmbRegs) / sizeof(BmbRegs[0]))
+
+typedef Crc<uint8_t, 8, 0x2F> CmdCrc;       //command PEC, seeded with 0x10
 
 
 //Tom Magic....
@@ -176,24 +187,56 @@ uint16_t LoopRanCnt =0;
 uint8_t WakeCnt = 0;
 uint8_t WaitCnt = 0;
 uint16_t IdleCnt = 0;
+uint16_t IdleTicks = 0;
+bool PublishPending = false;
 uint8_t ChipNum =0;
-float CellVMax = 0;
-float CellVMin = 5000;
-float TempMax = 0;
-float TempMin = 1000;
-uint16_t SendDelay = 1000;
+bool Discovering = true;
+uint16_t SendDelay = 100; //us between commands of a sequence
+uint8_t  RetryReq[BMB_MAX_READS] = {0}; //registers to re-read after a PEC failure
+uint8_t  RetryCnt = 0;
+uint32_t PecGood[BMB_MAX_CHIPS] = {0}; //frames since the last publish
+uint32_t PecBad[BMB_MAX_CHIPS] = {0};
+uint16_t PecRetries = 0;
 uint32_t lasttime = 0;
 bool BalEven = false;
 
-float Cell1start, Cell2start = 0;
+uint16_t Cell1start, Cell2start = 0;
 
 void BATMan::BatStart()
 {
-    ChipNum = Param::GetInt(Param::numbmbs)*2;
+    ChipNum = MIN(Param::GetInt(Param::numbmbs)*2, BMB_MAX_CHIPS);
+    Discovering = true;
+    SetScanTime(Param::GetInt(Param::ScanTime));
+}
+
+void BATMan::SetScanTime(int ms)
+{
+    int ticks = ms / BMB_TICK_MS - BMB_ACTIVE_TICKS;
+
+    IdleTicks = ticks > 0 ? ticks : 0;
 }
 
-void BATMan::loop() //runs every 100ms
+void BATMan::loop() //runs every 10ms
 {
+    if (SpiBusy)
+    {
+        //a sequence never takes more than a few ms, if it is still running now the chain is stuck
+        if (++WaitCnt > 2)
+        {
+            AbortSequence();
+        }
+        return;
+    }
+    WaitCnt = 0;
+
+    if (RetryCnt > 0)
+    {
+        //re-read only the registers that failed, the state machine picks up again next tick
+        QueueRetries();
+        RunSequence();
+        return;
+    }
+
     StateMachine();
 }
 
@@ -206,12 +249,8 @@ void BATMan::StateMachine()
         if(BmbTimeout == true)
         {
             WakeUP();//send wake up 4 times for 4 bmb boards
-            LoopState++;
-        }
-        else
-        {
-            LoopState++;
         }
+        LoopState++;
         break;
     }
 
@@ -219,16 +258,17 @@ void BATMan::StateMachine()
     {
         IdleWake();//unmute
         GetData(0x4D);//Read Aux A.Contains 5v reg voltage in word 1
-        GetData(0x50);//Read Cfg
+        if (Discovering)
+            ProbeChain();//Read Cfg from as many chips as we could ever have
+        else
+            GetData(0x50);//Read Cfg
         LoopState++;
         break;
     }
 
-    case 2:
+    case 2: //the first snapshot was queued at the end of the previous cycle
     {
-        IdleWake();//unmute
-        delay(SendDelay);
-        Generic_Send_Once(Snap, 1);//Take a snapshot of the cell voltages
+        QueueSnapshot();
         LoopState++;
         break;
     }
@@ -236,46 +276,37 @@ void BATMan::StateMachine()
     case 3:
     {
         IdleWake();//unmute
-        delay(SendDelay);
-        Generic_Send_Once(Snap, 1);//Take a snapshot of the cell voltages
-        LoopState++;
-        break;
-    }
-
-    case 4:
-    {
-        IdleWake();//unmute
-        delay(SendDelay);
+        Wait(SendDelay);
         GetData(0x4F);//Read status reg
-        delay(SendDelay);
+        Wait(SendDelay);
         GetData(0x4F);//Read status reg
-        delay(SendDelay);
+        Wait(SendDelay);
         GetData(0x47);//Read A. Contains Cell voltage measurements
-        delay(SendDelay);
+        Wait(SendDelay);
         GetData(0x48);//Read B. Contains Cell voltage measurements
-        delay(SendDelay);
+        Wait(SendDelay);
         GetData(0x49);//Read C. Contains Cell voltage measurements
-        delay(SendDelay);
+        Wait(SendDelay);
         GetData(0x4A);//Read D. Contains Cell voltage measurements
 
         LoopState++;
         break;
     }
 
-    case 5:
+    case 4:
     {
         IdleWake();//unmute
-        delay(SendDelay);
+        Wait(SendDelay);
         GetData(0x4F);//Read status reg
-        delay(SendDelay);
+        Wait(SendDelay);
         GetData(0x4F);//Read status reg
-        delay(SendDelay);
+        Wait(SendDelay);
         GetData(0x4B);//Read E. Contains Cell voltage measurements
-        delay(SendDelay);
+        Wait(SendDelay);
         GetData(0x4C);//Read F. Contains chip total V in word 1.
-        delay(SendDelay);
+        Wait(SendDelay);
         GetData(0x4D);//Read F. Contains chip total V in word 1.
-        delay(SendDelay);
+        Wait(SendDelay);
         GetTempData();//Request temps
 
         //WriteCfg();
@@ -284,37 +315,37 @@ void BATMan::StateMachine()
         break;
     }
 
-    case 6: //first state check if there is time out of commms requiring full wake
+    case 5: //first state check if there is time out of commms requiring full wake
     {
         WakeUP();//send wake up 4 times for 4 bmb boards
         GetData(0x50);//Read Cfg
         WriteCfg();
         GetData(0x50);//Read Cfg
         Generic_Send_Once(Unmute, 2);//unmute
-        LoopState++;
-        break;
-    }
-
-    case 7:
-    {
+        PublishPending = true;//publish while the config write shifts out
 
-        upDateTemps();
-        upDateCellVolts();
-        upDateAuxVolts();
-        LoopState++;
+        if (IdleTicks == 0)
+        {
+            //ScanTime of 60 ms, running flat out: the next cycle's snapshot converts while this one is published
+            Wait(SendDelay);
+            QueueSnapshot();
+            EndCycle();
+        }
+        else
+        {
+            LoopState++;
+        }
         break;
     }
 
-    case 8: //Waiting State
+    case 6: //Waiting State, pads the cycle out to the configured scan time
     {
         IdleCnt++;
 
-        if(IdleCnt > cycletime)
+        if(IdleCnt >= IdleTicks)
         {
-            LoopState = 0;
-            IdleCnt = 0;
-            LoopRanCnt++;
-            Param::SetInt(Param::LoopCnt, LoopRanCnt);
+            QueueSnapshot();
+            EndCycle();
         }
         break;
     }
@@ -326,10 +357,37 @@ void BATMan::StateMachine()
 
     }
 
+    //start whatever the state queued, then decode the previous sequence while it runs
+    RunSequence();
+
+    if (PublishPending)
+    {
+        upDateTemps();
+        upDateCellVolts();
+        upDateAuxVolts();
+        upDatePecStats();
+        PublishPending = false;
+    }
+
     Param::SetInt(Param::LoopState, LoopState);
 }
 
 
+void BATMan::QueueSnapshot()
+{
+    IdleWake();//unmute
+    Wait(SendDelay);
+    Generic_Send_Once(Snap, 1);//Take a snapshot of the cell voltages
+}
+
+void BATMan::EndCycle()
+{
+    LoopState = 0;
+    IdleCnt = 0;
+    LoopRanCnt++;
+    Param::SetInt(Param::LoopCnt, LoopRanCnt);
+}
+
 void BATMan::IdleWake()
 {
     if(BalanceFlag == true)
@@ -343,179 +401,179 @@ void BATMan::IdleWake()
     }
 }
 
+void BATMan::QueueRetries()
+{
+    IdleWake();//unmute
+
+    for (uint8_t i = 0; i < RetryCnt; i++)
+    {
+        Wait(SendDelay);
+        GetData(RetryReq[i] | REQ_RETRY);
+    }
+    PecRetries += RetryCnt;
+    RetryCnt = 0;
+}
+
 void BATMan::GetData(uint8_t ReqID)
 {
     uint8_t tempData[2] = {0};
     uint16_t ReqData[2] = {0};
 
-    tempData[0] = ReqID;
+    tempData[0] = ReqID & ~REQ_RETRY;
 
-    ReqData[0] = ReqID << 8;
-    ReqData[1] = (calcCRC(tempData, 2))<<8;
+    ReqData[0] = tempData[0] << 8;
+    ReqData[1] = CmdCrc::Calc(tempData, 2, 0x10) << 8;
 
+    QueueCommand(ReqData, BMB_CMD_WORDS, BMB_CMD_WORDS + BMB_FRAME_WORDS(ChipNum), ReqID);
+}
 
+void BATMan::ProbeChain()
+{
+    uint8_t tempData[2] = {REG_CFG, 0};
+    uint16_t ReqData[2] = {0};
 
-    DigIo::BMAN_CS.Clear();
+    ReqData[0] = REG_CFG << 8;
+    ReqData[1] = CmdCrc::Calc(tempData, 2, 0x10) << 8;
 
-    receive1 = spi_xfer(SPI1, ReqData[0]);  // do a transfer
-    receive2 = spi_xfer(SPI1, ReqData[1]);  // do a transfer
+    QueueCommand(ReqData, BMB_CMD_WORDS, BMB_XFER_WORDS, REQ_PROBE);
+}
 
-    //receive1 = spi_xfer(SPI1, Request[0]);  // do a transfer
-    // receive2 = spi_xfer(SPI1, Request[1]);  // do a transfer
+/* Chips answer in chain order, the chain length is the number of leading
+ * config blocks with a valid PEC. Past the last chip the frame reads back
+ * idle bus which never passes.
+ */
+void BATMan::CountChips(const uint16_t* rxData)
+{
+    uint8_t found = 0;
+    uint8_t expected = MIN(Param::GetInt(Param::numbmbs)*2, BMB_MAX_CHIPS);
 
-    for (count2 = 0; count2 <= 72; count2 = count2 + 2)
+    //without the PEC idle bus can't be told from a chip, trust numbmbs
+    if (!Param::GetBool(Param::PecCheck))
     {
-        receive1 = spi_xfer(SPI1, padding);  // do a transfer
-        Fluffer[count2] = receive1 >> 8;
-        Fluffer[count2 + 1] = receive1 & 0xFF;
+        Param::SetInt(Param::ChipsFound, 0);
+        ChipNum = expected;
+        Discovering = false;
+        return;
     }
-    DigIo::BMAN_CS.Set();
 
-    uint16_t tempvol = 0;
+    for (uint16_t w = 0; w < BMB_FRAME_WORDS(BMB_MAX_CHIPS); w++)
+    {
+        Fluffer[w * 2] = rxData[BMB_CMD_WORDS + w] >> 8;
+        Fluffer[w * 2 + 1] = rxData[BMB_CMD_WORDS + w] & 0xFF;
+    }
 
-    switch (ReqID)
+    while (found < BMB_MAX_CHIPS && BmbPec::Check(&Fluffer[found * 7], 7))
     {
-    case 0x47:
-        for (int h = 0; h <= 8; h++)
-        {
-            for (int g = 0; g <= 2; g++)
-            {
-                tempvol = Fluffer[1 + (h * 9) + (g * 2)] * 256 + Fluffer [0 + (h * 9) + (g * 2)];
-                if (tempvol != 0xffff)
-                {
-                    Voltage[h][g] = tempvol / 12.5;
-                }
-            }
-        }
-        break;
+        found++;
+    }
+    Param::SetInt(Param::ChipsFound, found);
 
-    case 0x48:
-        for (int h = 0; h <= 8; h++)
-        {
-            for (int g = 3; g <= 5; g++)
-            {
-                tempvol = Fluffer[1 + (h * 9) + ((g - 3) * 2)] * 256 + Fluffer [0 + (h * 9) + ((g - 3) * 2)];
-                if (tempvol != 0xffff)
-                {
-                    Voltage[h][g] = tempvol / 12.5;
-                }
-            }
-        }
-        break;
+    if (found != expected)
+    {
+        ErrorMessage::Post(ERR_BMBCOUNT);
+    }
 
-    case 0x49:
-        for (int h = 0; h <= 8; h++)
+    //nothing answered, keep the configured chain and probe again next cycle
+    if (found > 0)
+    {
+        ChipNum = found;
+        Discovering = false;
+    }
+}
+
+void BATMan::DecodeData(uint8_t ReqID, const uint16_t* rxData)
+{
+    bool retry = (ReqID & REQ_RETRY) != 0;
+
+    ReqID &= ~REQ_RETRY;
+
+    if (ReqID == REQ_PROBE)
+    {
+        CountChips(rxData);
+        return;
+    }
+
+    if (ReqID == (reqTemp >> 8))
+    {
+        for (count3 = 0; count3 < ChipNum; count3 ++)
         {
-            for (int g = 6; g <= 8; g++)
+            receive1 = rxData[2 + count3 * 4];//temperatures returned in words 1, 5, 9 ...
+            if(receive1 != 0xFFFF)
             {
-                tempvol = Fluffer[1 + (h * 9) + ((g - 6) * 2)] * 256 + Fluffer [0 + (h * 9) + ((g - 6) * 2)];
-                if (tempvol != 0xffff)
-                {
-                    Voltage[h][g] = tempvol / 12.5 ;
-                }
+                Temps[count3]=receive1;
             }
         }
-        break;
+        return;
+    }
+
+    for (uint16_t w = 0; w < BMB_FRAME_WORDS(ChipNum); w++)
+    {
+        receive1 = rxData[BMB_CMD_WORDS + w];
+        Fluffer[w * 2] = receive1 >> 8;
+        Fluffer[w * 2 + 1] = receive1 & 0xFF;
+    }
+
+    const BmbReg* first = BmbRegs;
+    const BmbReg* last = BmbRegs + REG_COUNT;
+    bool failed = false;
+    bool checkPec = Param::GetBool(Param::PecCheck);
 
+    while (first < last && first->reqId != ReqID) first++;
+    if (first == last) return; //status reads are not decoded
 
-    case 0x4A:
-        for (int h = 0; h <= 8; h++)
+    for (uint8_t h = 0; h < ChipNum; h++)
+    {
+        const uint8_t* block = &Fluffer[h * first->stride];
+
+        if (!checkPec)
         {
-            for (int g = 9; g <= 11; g++)
-            {
-                tempvol = Fluffer[1 + (h * 9) + ((g - 9) * 2)] * 256 + Fluffer [0 + (h * 9) + ((g - 9) * 2)];
-                if (tempvol != 0xffff)
-                {
-                    Voltage[h][g] = tempvol / 12.5;
-                }
-            }
+            //taken as is, only the 0xffff filter below applies
         }
-        break;
-
-    case 0x4B:
-        for (int h = 0; h <= 8; h++)
+        else if (BmbPec::Check(block, first->stride))
         {
-            for (int g = 12; g <= 14; g++)
-            {
-                tempvol = Fluffer[1 + (h * 9) + ((g - 12) * 2)] * 256 + Fluffer [0 + (h * 9) + ((g - 12) * 2)];
-                if (tempvol != 0xffff)
-                {
-                    Voltage[h][g] = tempvol / 12.5;
-                }
-            }
+            PecGood[h]++;
         }
-        break;
-
-    case 0x4C:
-        for (int h = 0; h <= 8; h++)
+        else
         {
-            tempvol = Fluffer[3 + (h * 7)] * 256 + Fluffer [2 + (h * 7)];
-            if (tempvol != 0xffff)
-            {
-                ChipV[h] = tempvol;
-            }
+            PecBad[h]++;
+            failed = true;
+            continue; //keep the last good reading
         }
-        break;
-
 
-    case 0x4D:
-        for (int h = 0; h < 8; h++)
+        //rows of one register are adjacent in the table
+        for (const BmbReg* reg = first; reg < last && reg->reqId == ReqID; reg++)
         {
-            tempvol = Fluffer[1 + (h * 9)] * 256 + Fluffer [0 + (h * 9)];
-            if (tempvol != 0xffff)
-            {
-                Temp1[h] = tempvol;
-            }
-
+            const uint8_t* chip = block + reg->firstByte;
+            uint16_t* dest = reg->dest + h * reg->destStride;
 
-            tempvol = Fluffer[3 + (h * 9)] * 256 + Fluffer [2 + (h * 9)];
-            if (tempvol != 0xffff)
+            for (uint8_t g = 0; g < reg->words; g++)
             {
-                if(h == 0 || h == 3 || h == 5 || h == 7)
-                {
-                    Volts5v[h] = rev16(tempvol);
-                }
-                else
-                {
-                    Volts5v[h] = tempvol;
-                }
-            }
+                uint16_t tempvol;
 
-            tempvol = Fluffer[5 + (h * 9)] * 256 + Fluffer [4 + (h * 9)];
-            if (tempvol != 0xffff)
-            {
-                Temp2[h] = tempvol;
-            }
-        }
-        break;
+                if (reg->flags & REG_BIGEND)
+                    tempvol = chip[2 * g] * 256 + chip[2 * g + 1];
+                else
+                    tempvol = chip[2 * g + 1] * 256 + chip[2 * g];
 
-    case 0x50:
-        for (int h = 0; h < 8; h++)
-        {
-            tempvol = Fluffer[0 + (h * 7)] * 256 + Fluffer [1 + (h * 7)];
-            if (tempvol != 0xffff)
-            {
-                Cfg[h][0] = tempvol;
-            }
+                if (tempvol == 0xffff) continue; //chip did not answer
 
+                if (reg->flags & REG_CELLMV)
+                    tempvol = CELL_MV(tempvol);
+                else if ((reg->flags & REG_5VSWAP) && ((SWAP5V_CHIPS >> (h & 7)) & 1))
+                    tempvol = rev16(tempvol);
 
-            tempvol = Fluffer[2 + (h * 7)] * 256 + Fluffer [3 + (h * 7)];
-            if (tempvol != 0xffff)
-            {
-                Cfg[h][1] =  tempvol;
+                dest[g] = tempvol;
             }
         }
-        break;
-
-
-    default:
-        // statements
-        break;
     }
 
+    //one retry per register, a second failure waits for the next cycle
+    if (failed && !retry && RetryCnt < BMB_MAX_READS)
+    {
+        RetryReq[RetryCnt++] = ReqID;
+    }
 }
 
-
 void BATMan::WriteCfg()
 {
     // CMD(one byte) PEC(one byte)
@@ -523,19 +581,19 @@ void BATMan::WriteCfg()
 
     //uint8_t DCC16_9 = 0;
     //uint8_t DCC8_1 = 0;
-    uint16_t cfgwrt [25] = {0};
+    uint16_t cfgwrt [1 + BMB_MAX_CHIPS * 3] = {0};
 
     cfgwrt[0]= 0x112F;        //CMD
 
-    for (int h = 0; h < 8; h++)//write the 8 BMB registers
+    for (int h = 0; h < ChipNum; h++)//write the config register of every chip
     {
 
         tempData[0]=0xF3;
         tempData[1]=0x00;
         // Note can not be adjacent cells
         //first copy all cells we want to balance
-        tempData[2]=CellBalCmd[7-h] & 0x00FF; //balancing 8-1
-        tempData[3]=(CellBalCmd[7-h] & 0xFF00)>>8; //balancing  16-9
+        tempData[2]=CellBalCmd[ChipNum-1-h] & 0x00FF; //balancing 8-1
+        tempData[3]=(CellBalCmd[ChipNum-1-h] & 0xFF00)>>8; //balancing  16-9
 
         //now alternate between even and odd using AND 0x55 or 0xAA
 
@@ -550,10 +608,7 @@ void BATMan::WriteCfg()
             tempData[3] = tempData[3] & 0x55;
         }
 
-        uint16_t payPec =0x0010;
-
-        crc14_bytes(4,tempData,&payPec);
-        crc14_bits(2,2,&payPec);
+        uint16_t payPec = BmbPec::Calc(tempData, 4, 2);
 
         cfgwrt[1+h*3] = tempData[1] + (tempData[0] << 8);
         cfgwrt[2+h*3] = tempData[3] + (tempData[2] << 8);
@@ -569,139 +624,259 @@ void BATMan::WriteCfg()
         BalEven = false;
     }
 
-    DigIo::BMAN_CS.Clear();
+    QueueCommand(cfgwrt, 1 + ChipNum * 3, 1 + ChipNum * 3, 0);
+}
 
-    for (int cnt = 0; cnt < 25; cnt++)
+
+void BATMan::GetTempData ()  //request
+{
+    QueueCommand(&reqTemp, 1, BMB_TEMP_WORDS(ChipNum), reqTemp >> 8);
+}
+
+void BATMan::WakeUP()
+{
+    for (count1 = 0; count1 <= 4; count1++)
     {
-        receive1 = spi_xfer(SPI1, cfgwrt[cnt]);  // do a transfer
+        QueueCommand(WakeUp, 1, 1, 0);
     }
-    DigIo::BMAN_CS.Set();
 }
 
+void BATMan::Generic_Send_Once(uint16_t Command[], uint8_t len)
+{
+    QueueCommand(Command, len, len, 0);
+}
 
-void BATMan::GetTempData ()  //request
+void BATMan::Wait(uint16_t us)
 {
-    padding=0x0000;
-    DigIo::BMAN_CS.Clear();
-    receive1 = spi_xfer(SPI1, reqTemp);  // do a transfer
-    for (count3 = 0; count3 < 32; count3 ++)
+    if (SeqLen > 0)
+    {
+        SeqOps[SeqLen - 1].gap = us;
+    }
+}
+
+void BATMan::QueueCommand(const uint16_t* cmd, uint8_t cmdLen, uint8_t len, uint8_t ReqID)
+{
+    if (SeqLen >= BMB_MAX_OPS || (TxLen + cmdLen) > BMB_TX_WORDS) return;
+
+    BmbOp& op = SeqOps[SeqLen];
+
+    op.txOfs = TxLen;
+    op.cmdLen = cmdLen;
+    op.len = len;
+    op.gap = 0;
+    op.rx = 0;
+
+    for (uint8_t i = 0; i < cmdLen; i++)
+    {
+        SpiTx[TxLen++] = cmd[i];
+    }
+
+    if (ReqID != 0 && ReadCnt < BMB_MAX_READS)
+    {
+        op.rx = SpiRx[RxBank][ReadCnt];
+        SpiReq[RxBank][ReadCnt] = ReqID;
+        ReadCnt++;
+    }
+    SeqLen++;
+}
+
+void BATMan::RunSequence()
+{
+    uint8_t lastBank = RxBank ^ 1;
+
+    if (SeqLen > 0)
+    {
+        SeqIdx = 0;
+        SpiBusy = true;
+        StartOp();
+        RxBank = lastBank;
+    }
+
+    for (uint8_t i = 0; i < BMB_MAX_READS; i++)
     {
-        receive1 = spi_xfer(SPI1, padding);  // do a transfer
-        if(receive1 != 0xFFFF)
+        if (SpiReq[lastBank][i] != 0)
         {
-            if(count3==1) Temps[0]=receive1;//temperature 1
-            if(count3==5) Temps[1]=receive1;//temperature 2
-            if(count3==9) Temps[2]=receive1;//temperature 3
-            if(count3==13) Temps[3]=receive1;//temperature 4
-            if(count3==17) Temps[4]=receive1;//temperature 5
-            if(count3==21) Temps[5]=receive1;//temperature 6
-            if(count3==25) Temps[6]=receive1;//temperature 7
-            if(count3==29) Temps[7]=receive1;//temperature 8
+            DecodeData(SpiReq[lastBank][i], SpiRx[lastBank][i]);
+            SpiReq[lastBank][i] = 0;
         }
     }
-    DigIo::BMAN_CS.Set();
 
-    //Param::SetFloat(Param::temp,69);
-
-    //delay(200);
+    SeqLen = 0;
+    TxLen = 0;
+    ReadCnt = 0;
 }
 
-void BATMan::WakeUP()
+void BATMan::AbortSequence()
 {
-    for (count1 = 0; count1 <= 4; count1++)
+    spi_disable_rx_buffer_not_empty_interrupt(SPI1);
+    timer_disable_counter(TIM4);
+    //A gap that ran out while we got here must not start the next op of the dead sequence
+    timer_clear_flag(TIM4, TIM_SR_UIF);
+    nvic_clear_pending_irq(NVIC_TIM4_IRQ);
+    DigIo::BMAN_CS.Set();
+    SpiBusy = false;
+    BmbTimeout = true;
+    WaitCnt = 0;
+
+    //RunSequence already flipped RxBank, the dead sequence shifted into the other one.
+    //Its frames are only partly filled, so they must never reach DecodeData
+    for (uint8_t i = 0; i < BMB_MAX_READS; i++)
     {
-        DigIo::BMAN_CS.Clear();
-        receive1 = spi_xfer(SPI1, WakeUp[0]);  // do a transfer
-        DigIo::BMAN_CS.Set();
+        SpiReq[RxBank ^ 1][i] = 0;
     }
 }
 
-void BATMan::Generic_Send_Once(uint16_t Command[], uint8_t len)
+void BATMan::StartOp()
 {
+    SpiIdx = 0;
+    (void)SPI_DR(SPI1); //drop any stale word
     DigIo::BMAN_CS.Clear();
-    for (int h = 0; h < len; h++)
+    spi_enable_rx_buffer_not_empty_interrupt(SPI1);
+    SPI_DR(SPI1) = SpiTx[SeqOps[SeqIdx].txOfs];
+}
+
+void BATMan::SpiInterrupt()
+{
+    const BmbOp& op = SeqOps[SeqIdx];
+    uint8_t idx = SpiIdx;
+    uint16_t data = SPI_DR(SPI1);
+
+    if (op.rx != 0)
     {
-        receive1 = spi_xfer(SPI1, Command[h]);  // do a transfer
+        op.rx[idx] = data;
     }
+    idx++;
+    SpiIdx = idx;
+
+    if (idx < op.len)
+    {
+        SPI_DR(SPI1) = idx < op.cmdLen ? SpiTx[op.txOfs + idx] : padding;
+        return;
+    }
+
+    spi_disable_rx_buffer_not_empty_interrupt(SPI1);
     DigIo::BMAN_CS.Set();
+    SeqIdx++;
+
+    if (SeqIdx >= SeqLen)
+    {
+        SpiBusy = false;
+    }
+    else if (op.gap == 0)
+    {
+        StartOp();
+    }
+    else
+    {
+        timer_set_period(TIM4, op.gap);
+        timer_set_counter(TIM4, 0);
+        timer_enable_counter(TIM4);
+    }
+}
+
+void BATMan::TimerInterrupt()
+{
+    timer_clear_flag(TIM4, TIM_SR_UIF);
+    StartOp();
+}
+
+extern "C" void spi1_isr(void)
+{
+    BATMan::SpiInterrupt();
+}
 
+extern "C" void tim4_isr(void)
+{
+    BATMan::TimerInterrupt();
 }
 
 void BATMan::upDateCellVolts(void)
 {
-    uint8_t Xr = 0; //BMB number
-    uint8_t Yc = 0; //Cell voltage register number
-    uint8_t hc = 0; //Cells present per chip
-    uint8_t h = 0; //Spot value index
+    uint16_t cellMax = 0;
+    uint16_t cellMin = 0xffff;
+    uint16_t maxIdx = 0;
+    uint16_t minIdx = 0;
+    uint32_t sum = 0;
+    uint16_t h = 0; //Spot value index
     uint16_t CellBalancing = 0;
 
-    BalanceFlag = false;
-    CellVMax = 0;
-    CellVMin = 5000;
-
-    for(uint8_t L =0; L < 8; L++)
+    //one pass collects the present cells and their statistics
+    for (uint8_t Xr = 0; Xr < ChipNum; Xr++)
     {
-        CellBalCmd[L] = 0;
+        uint8_t hc = 0; //Cells present per chip
+
+        for (uint8_t Yc = 0; Yc < BMB_CHIP_CELLS; Yc++)
+        {
+            uint16_t v = Voltage[Xr][Yc];
+
+            if (v <= 10) continue; //Check actual measurement present
+
+            if (v > cellMax)
+            {
+                cellMax = v;
+                maxIdx = h;
+            }
+            if (v < cellMin)
+            {
+                cellMin = v;
+                minIdx = h;
+            }
+            sum += v;
+            Cells[h++] = v;
+            hc++;
+        }
+
+        if (Xr <= Param::Chip8Cells - Param::Chip1Cells)
+            Param::SetInt((Param::PARAM_NUM)(Param::Chip1Cells+Xr),hc);
     }
 
-    while (h <= 100)
+    if (h == 0) cellMin = 0;
+
+    //balance against this cycle's minimum
+    bool balance = Param::GetInt(Param::balance) && h > 0;
+
+    BalanceFlag = false;
+
+    for (uint8_t Xr = 0; Xr < ChipNum; Xr++)
     {
-        if(Yc < 14) //Check actual measurement present
+        uint16_t mask = 0;
+
+        if (balance)
         {
-            if(Voltage[Xr][Yc] > 10) //Check actual measurement present
+            for (uint8_t Yc = 0; Yc < BMB_CHIP_CELLS; Yc++)
             {
-                if (CellVMax< Voltage[Xr][Yc])
-                {
-                    CellVMax =  Voltage[Xr][Yc];
-                    Param::SetInt(Param::umax, h+1);
-                }
-                if (CellVMin > Voltage[Xr][Yc])
-                {
-                    CellVMin =  Voltage[Xr][Yc];
-                    Param::SetInt(Param::umin, h+1);
-                }
-                Param::SetFloat((Param::PARAM_NUM)(Param::u1 + h), (Voltage[Xr][Yc]));
-                //section to do balancing setup
-                if(Param::GetInt(Param::balance)) // Check if balancing flag is set
+                uint16_t v = Voltage[Xr][Yc];
+
+                if (v > 10 && v > cellMin + BalHys)
                 {
-                    if((Param::GetFloat(Param::umin) + BalHys) < Voltage[Xr][Yc])
-                    {
-                        CellBalCmd[Xr] = CellBalCmd[Xr]+(0x01 << Yc);//populate balancing command register
-                        CellBalancing++;
-                        BalanceFlag = true;
-                    }
+                    mask |= 1 << Yc;
+                    CellBalancing++;
                 }
-                //
-                h++; //next cell spot value along
-                hc++; //one more cell present
             }
-
-            Yc++; //next cell along
-        }
-        else
-        {
-            Param::SetInt((Param::PARAM_NUM)(Param::Chip1Cells+Xr),hc);
-            Yc = 0; //reset Cell colum
-            hc = 0; //reset cell count per chip
-            Xr++; //next BMB
         }
+        CellBalCmd[Xr] = mask;
+        BalanceFlag |= mask != 0;
+    }
 
-        if(Xr == ChipNum)
-        {
-            Param::SetFloat(Param::umax,CellVMax);
-            Param::SetFloat(Param::umin,CellVMin);
-            Param::SetFloat(Param::deltaV,CellVMax-CellVMin);
-            Param::SetInt(Param::CellsPresent,h);
-            h = 100;
-            break;
-        }
+    for (uint16_t i = 0; i < h && i <= Param::u120 - Param::u1; i++)
+    {
+        Param::SetInt((Param::PARAM_NUM)(Param::u1 + i), Cells[i]);
     }
 
+    Param::SetInt(Param::umax, cellMax);
+    Param::SetInt(Param::umin, cellMin);
+    Param::SetInt(Param::umaxcell, maxIdx + 1);
+    Param::SetInt(Param::umincell, minIdx + 1);
+    Param::SetInt(Param::deltaV, cellMax - cellMin);
+    Param::SetInt(Param::CellsPresent, h);
+    if (h > 0)
+        Param::SetInt(Param::uavg, sum / h);
+
 //debugging balancing//
     if(Cell1start == 0)
     {
-        Cell1start= Param::GetFloat(Param::u1);
-        Cell2start=Param::GetFloat(Param::u2);
+        Cell1start= Param::GetInt(Param::u1);
+        Cell2start=Param::GetInt(Param::u2);
         //Param::SetFloat(Param::dischargelim,Cell1start);
         //Param::SetFloat(Param::chargelim,Cell2start);
     }
@@ -716,135 +891,89 @@ void BATMan::upDateAuxVolts(void)
     //Param::SetInt(Param::Chip2_5V,((Volts5v[1]))/12.5);
     //Param::SetInt(Param::soc,((Volts5v[2])));
 
-    Param::SetFloat(Param::udc,0);
+    int32_t udc = 0; //mV
+    int32_t cells = Param::GetInt(Param::CellsPresent);
 
-    if(Param::GetInt(Param::numbmbs) >= 1)
-    {
-        Param::SetFloat(Param::ChipV1,ChipV[0]*0.001280);
-        Param::SetFloat(Param::ChipV2,ChipV[1]*0.001280);
-        Param::SetFloat(Param::udc,(Param::GetFloat(Param::ChipV1)+Param::GetFloat(Param::ChipV2)));
-    }
-    if(Param::GetInt(Param::numbmbs) >= 2)
-    {
-        Param::SetFloat(Param::ChipV3,ChipV[2]*0.001280);
-        Param::SetFloat(Param::ChipV4,ChipV[3]*0.001280);
-        Param::SetFloat(Param::udc,(Param::GetFloat(Param::udc)+Param::GetFloat(Param::ChipV3)+Param::GetFloat(Param::ChipV4)));
-    }
-    if(Param::GetInt(Param::numbmbs) >= 3)
-    {
-        Param::SetFloat(Param::ChipV5,ChipV[4]*0.001280);
-        Param::SetFloat(Param::ChipV6,ChipV[5]*0.001280);
-        Param::SetFloat(Param::udc,(Param::GetFloat(Param::udc)+Param::GetFloat(Param::ChipV5)+Param::GetFloat(Param::ChipV6)));
-    }
-    if(Param::GetInt(Param::numbmbs) == 4)
+    for (int g = 0; g < ChipNum; g++)
     {
-        Param::SetFloat(Param::ChipV7,ChipV[6]*0.001280);
-        Param::SetFloat(Param::ChipV8,ChipV[7]*0.001280);
-        Param::SetFloat(Param::udc,(Param::GetFloat(Param::udc)+Param::GetFloat(Param::ChipV7)+Param::GetFloat(Param::ChipV8)));
-    }
+        uint32_t chipV = CHIP_MV(ChipV[g]);
 
-    Param::SetInt(Param::uavg,(Param::GetFloat(Param::udc)/Param::GetInt(Param::CellsPresent)*1000));
+        udc += chipV;
+        if (g <= Param::ChipV8 - Param::ChipV1)
+            Param::SetFixed((Param::PARAM_NUM)(Param::ChipV1 + g), MV_TO_FP(chipV));
+    }
+    Param::SetFixed(Param::udc, MV_TO_FP(udc));
 
     //Set Charge and discharge voltage limits !!! Update with configrable
-    Param::SetFloat(Param::chargeVlim,(Param::GetInt(Param::CellVmax)*0.001*Param::GetInt(Param::CellsPresent)));
-    Param::SetFloat(Param::dischargeVlim,(Param::GetInt(Param::CellVmin)*0.001*Param::GetInt(Param::CellsPresent)));
+    Param::SetFixed(Param::chargeVlim, MV_TO_FP(Param::GetInt(Param::CellVmax) * cells));
+    Param::SetFixed(Param::dischargeVlim, MV_TO_FP(Param::GetInt(Param::CellVmin) * cells));
 }
 
 void BATMan::upDateTemps(void)
 {
-
-    TempMax = 0;
-    TempMin= 100;
+    int16_t TempMax = 0; //0.1 degC
+    int16_t TempMin = 1000;
 
     for (int g = 0; g < ChipNum; g++)
     {
-        tempval1=rev16(Temps[g]);//bytes swapped in the 16 bit words
-        if (tempval1==0)
-        {
-            tempval2=0;
-        }
-        else if (tempval1 >= (1131))
-        {
-            tempval1 = tempval1-1131;
-            tempval2 = tempval1/10;
-        }
+        int16_t chipT = rev16(Temps[g]);//bytes swapped in the 16 bit words, 0.1 degC from 1131
 
-        else
+        if (chipT != 0)
         {
-            tempval1 = 1131-tempval1;
-            tempval2 = tempval1/10;
+            chipT = ABS(chipT - 1131);
         }
-        Param::SetFloat((Param::PARAM_NUM)(Param::Chipt1 + g), tempval2);
+        if (g <= Param::Chipt8 - Param::Chipt1)
+            Param::SetFixed((Param::PARAM_NUM)(Param::Chipt1 + g), DECI_TO_FP(chipT));
 
-        Temp1[g] = ((Temp1[g])*0.01)-40;
-        Temp2[g] = ((Temp2[g])*0.01)-40;
+        int16_t t1 = TEMP_DECI(Temp1[g]);
+        int16_t t2 = TEMP_DECI(Temp2[g]);
 
-        if(TempMax < Temp1[g])
-        {
-            TempMax = Temp1[g];
-        }
-        if(TempMax < Temp2[g])
-        {
-            TempMax = Temp2[g];
-        }
-
-        if(TempMin > Temp1[g])
-        {
-            TempMin = Temp1[g];
-        }
+        TempMax = MAX(TempMax, MAX(t1, t2));
+        TempMin = MIN(TempMin, MIN(t1, t2));
 
-        if(TempMin > Temp2[g])
+        if (g * 2 < Param::Cellt20_1 - Param::Cellt1_0)
         {
-            TempMin = Temp2[g];
+            Param::SetFixed((Param::PARAM_NUM)(Param::Cellt1_0 + g*2), DECI_TO_FP(t1));
+            Param::SetFixed((Param::PARAM_NUM)(Param::Cellt1_1 + g*2), DECI_TO_FP(t2));
         }
-
-        Param::SetFloat((Param::PARAM_NUM)(Param::Cellt1_0 + g*2),Temp1[g]);
-        Param::SetFloat((Param::PARAM_NUM)(Param::Cellt1_1 + g*2),Temp2[g]);
     }
-    Param::SetFloat(Param::TempMax,TempMax);
-    Param::SetFloat(Param::TempMin,TempMin);
+    Param::SetFixed(Param::TempMax, DECI_TO_FP(TempMax));
+    Param::SetFixed(Param::TempMin, DECI_TO_FP(TempMin));
 }
 
-uint8_t BATMan::calcCRC(uint8_t *inData, uint8_t Length)
+void BATMan::upDatePecStats(void)
 {
-    uint8_t CRC8 =  0x10;
-    uint8_t crc_temp = 0;
-    for (uint8_t i = 0; i<Length; i++)
-    {
-        crc_temp = CRC8 ^ inData[i];
-        CRC8 = crcTable2f[crc_temp];
-    }
-    return(CRC8);
-}
+    uint32_t good = 0, bad = 0, worstBad = 0;
+    int worst = 0;
 
-void BATMan::crc14_bytes( uint8_t len_B, uint8_t *bytes, uint16_t *crcP )
-{
-    uint8_t pos, idx;
-
-    for ( idx = 0; idx < len_B; idx++ )
+    //each BMB carries two chips, the first four get their own spot values
+    for (int b = 0; b < ChipNum / 2; b++)
     {
-        pos = (uint8_t)((*crcP >> 6) ^ bytes[idx]);
-
-        *crcP = (uint16_t)( (0x3fff & (*crcP << 8)) ^ (uint16_t)(crc14table[pos]));
-    }
-}
+        uint32_t bmbGood = PecGood[b * 2] + PecGood[b * 2 + 1];
+        uint32_t bmbBad = PecBad[b * 2] + PecBad[b * 2 + 1];
 
-void BATMan::crc14_bits( uint8_t len_b,uint8_t inB, uint16_t *crcP )
-{
-    inB = inB & utilTopN[len_b];   // Mask out the bite we don't care about
-
-    *crcP ^= (uint16_t)((inB) << 6); /* move byte into MSB of 14bit CRC */
-
-    while( len_b-- )
-    {
-        if ((*crcP & 0x2000) != 0) /* test for MSB = bit 13 */
+        if (b <= Param::Bmb4Good - Param::Bmb1Good)
         {
-            *crcP = (uint16_t)((*crcP << 1) ^ crcPolyBmData);
+            Param::SetInt((Param::PARAM_NUM)(Param::Bmb1Good + b), bmbGood);
+            Param::SetInt((Param::PARAM_NUM)(Param::Bmb1Bad + b), bmbBad);
         }
-        else
+        if (bmbBad > worstBad)
         {
-            *crcP = (uint16_t)( *crcP << 1);
+            worstBad = bmbBad;
+            worst = b + 1;
         }
+        good += bmbGood;
+        bad += bmbBad;
     }
-    *crcP &= 0x3fff;
+
+    //counts are per publish so they can neither wrap nor outgrow a spot value
+    for (int h = 0; h < BMB_MAX_CHIPS; h++)
+    {
+        PecGood[h] = 0;
+        PecBad[h] = 0;
+    }
+
+    Param::SetFixed(Param::PecBadPct, good + bad > 0 ? FP_FROMINT(100 * bad) / (int)(good + bad) : 0);
+    Param::SetInt(Param::PecWorst, worst);
+    Param::SetInt(Param::PecRetries, PecRetries);
 }
@@ -9,213 +9,216 @@
 
 #include "ModelS.h"
 #include "BMSUtil.h"
+#include "errormessage.h"
 #include "my_math.h"
-#include "delay.h"
 #include <string.h>
 #include <libopencm3/stm32/usart.h>
 
 // Static member initialization
 TeslaBMSModule TeslaBMSManager::modules[MAX_MODULES + 1];
 int   TeslaBMSManager::numFoundModules = 0;
-float TeslaBMSManager::packVolt        = 0.0f;
-float TeslaBMSManager::lowCellVolt     = 0.0f;
-float TeslaBMSManager::highCellVolt    = 0.0f;
-float TeslaBMSManager::avgTemp         = 0.0f;
-float TeslaBMSManager::lowTemp         = 0.0f;
-float TeslaBMSManager::highTemp        = 0.0f;
+int32_t TeslaBMSManager::packVolt      = 0;
+int   TeslaBMSManager::lowCellVolt     = 0;
+int   TeslaBMSManager::highCellVolt    = 0;
+int   TeslaBMSManager::avgTemp         = 0;
+int   TeslaBMSManager::lowTemp         = 0;
+int   TeslaBMSManager::highTemp        = 0;
 int   TeslaBMSManager::totalCells      = 0;
+uint16_t TeslaBMSManager::cells[MAX_MODULES * 6];
+int   TeslaBMSManager::numCells        = 0;
 bool  TeslaBMSManager::initialized     = false;
 
+/* Cell ADC counts to mV, 0.381493 mV per count as a 16 bit fraction */
+#define CELL_COUNTS_TO_MV(c) (((uint32_t)(c) * 25002 + 0x8000) >> 16)
+
+/* Thermistor ADC counts to 0.1 degC.
+ * The compiler evaluates the Steinhart-Hart fit below once per table point,
+ * the firmware interpolates linearly between points. With 128 counts per
+ * step the error stays under 0.5 degC from -40 to 120 degC.
+ *   R = 1780 * 33046 / (counts + 2) - 3570                     (ohms, TS1)
+ *   T = 1 / (a + b * ln(R) + c * ln(R)^3) - 273.15
+ * TS2 has a slightly different divider and is mapped onto the TS1 scale.
+ */
+#define TEMP_STEP_BITS       7
+#define TEMP_POINTS          ((16384 >> TEMP_STEP_BITS) + 1)
+
+namespace Thermistor
+{
+template <unsigned... I> struct Seq {};
+template <unsigned N, unsigned... I> struct MakeSeq : MakeSeq<N - 1, N - 1, I...> {};
+template <unsigned... I> struct MakeSeq<0, I...> { typedef Seq<I...> type; };
+
+//ln(m) for m in [1, 2) from the atanh series, y = (m - 1) / (m + 1)
+constexpr double LnSeries(double y, double y2, double term, unsigned n)
+{
+    return n > 41 ? 0 : term / n + LnSeries(y, y2, term * y2, n + 2);
+}
+
+constexpr double LnMant(double m)
+{
+    return 2 * LnSeries((m - 1) / (m + 1), ((m - 1) / (m + 1)) * ((m - 1) / (m + 1)), (m - 1) / (m + 1), 1);
+}
+
+constexpr double Ln(double x)
+{
+    return x >= 2 ? Ln(x / 2) + 0.6931471805599453 : LnMant(x);
+}
+
+constexpr double Kelvin(double lnR)
+{
+    return 1.0 / (0.0007610373573 + 0.0002728524832 * lnR + 0.0000001022822735 * lnR * lnR * lnR);
+}
+
+constexpr int16_t Round(double x)
+{
+    return (int16_t)(x >= 0 ? x + 0.5 : x - 0.5);
+}
+
+constexpr int16_t DeciC(unsigned counts)
+{
+    return Round((Kelvin(Ln(1780.0 * 33046 / (counts + 2) - 3570)) - 273.15) * 10);
+}
+
+template <typename S> struct Table;
+
+template <unsigned... I>
+struct Table<Seq<I...> >
+{
+    static constexpr int16_t data[sizeof...(I)] = { DeciC(I << TEMP_STEP_BITS)... };
+};
+
+template <unsigned... I>
+constexpr int16_t Table<Seq<I...> >::data[sizeof...(I)];
+
+typedef Table<MakeSeq<TEMP_POINTS>::type> Tab;
+}
+
+static int16_t ThermistorTemp(uint32_t counts)
+{
+    if (counts > 16383) counts = 16383;
+    
+    uint32_t idx  = counts >> TEMP_STEP_BITS;
+    int32_t  frac = counts & ((1 << TEMP_STEP_BITS) - 1);
+    int32_t  lo   = Thermistor::Tab::data[idx];
+    
+    return lo + (Thermistor::Tab::data[idx + 1] - lo) * frac / (1 << TEMP_STEP_BITS);
+}
+
 /* -----------------------------------------------------------------------
  * TeslaBMSModule implementation
  * ----------------------------------------------------------------------- */
 TeslaBMSModule::TeslaBMSModule()
 {
     for (int i = 0; i < 6; i++) {
-        cellVolt[i]        = 0.0f;
-        lowestCellVolt[i]  = 5.0f;
-        highestCellVolt[i] = 0.0f;
+        cellVolt[i]        = 0;
+        lowestCellVolt[i]  = 5000;
+        highestCellVolt[i] = 0;
     }
-    moduleVolt         = 0.0f;
-    temperatures[0]    = 0.0f;
-    temperatures[1]    = 0.0f;
-    lowestTemperature  = 200.0f;
-    highestTemperature = -100.0f;
+    moduleVolt         = 0;
+    temperatures[0]    = 0;
+    temperatures[1]    = 0;
+    lowestTemperature  = 2000;
+    highestTemperature = -1000;
     exists             = false;
+    configured         = false;
+    misses             = 0;
     alerts             = 0;
     faults             = 0;
     COVFaults          = 0;
     CUVFaults          = 0;
     moduleAddress      = 0;
-    scells             = 6;
-    smiss              = 0;
-}
-
-void TeslaBMSModule::clearModule()
-{
-    for (int i = 0; i < 6; i++) cellVolt[i] = 0.0f;
-    moduleVolt      = 0.0f;
-    temperatures[0] = 0.0f;
-    temperatures[1] = 0.0f;
+    memset(&link, 0, sizeof(link));
 }
 
-void TeslaBMSModule::readStatus()
+void TeslaBMSModule::decodeStatus(const uint8_t *buff)
 {
-    uint8_t payload[3], buff[8];
-    
-    payload[0] = moduleAddress << 1;
-    payload[1] = 0;  // REG_DEV_STATUS
-    payload[2] = 0x01;
-    BMSUtil::SendDataWithReply(payload, 3, false, buff, 4);
-    
-    payload[0] = moduleAddress << 1;
-    payload[1] = 0x20;  // REG_ALERT_STATUS
-    payload[2] = 0x04;
-    BMSUtil::SendDataWithReply(payload, 3, false, buff, 7);
     alerts    = buff[3];
     faults    = buff[4];
     COVFaults = buff[5];
     CUVFaults = buff[6];
+    
+    // Power on reset flag in REG_FAULT_STATUS, control registers are back to defaults
+    if (faults & 0x08) configured = false;
 }
 
-void TeslaBMSModule::stopBalance()
+bool TeslaBMSModule::hasFault()
 {
-    uint8_t payload[3], buff[8];
-    payload[0] = moduleAddress << 1;
-    payload[1] = 0x32;  // REG_BAL_CTRL
-    payload[2] = 0;
-    BMSUtil::SendDataWithReply(payload, 3, true, buff, 4);
+    return (alerts | faults | COVFaults | CUVFaults) != 0;
 }
 
-bool TeslaBMSModule::readModuleValues()
+bool TeslaBMSModule::decodeValues(const uint8_t *buff, int retLen)
 {
-    uint8_t payload[4], buff[50];
-    uint8_t calcCRC;
-    int     retLen;
-    
-    payload[0] = moduleAddress << 1;
-    
-    readStatus();
+    if (retLen != 22 || buff[21] != BMSUtil::GenCRC((uint8_t*)buff, retLen - 1))
+        return false;
+    if (buff[0] != (moduleAddress << 1) || buff[1] != 0x01 || buff[2] != 0x12)
+        return false;
     
-    // Configure ADC
-    payload[1] = 0x30;  // REG_ADC_CTRL
-    payload[2] = 0b00111101;  // Auto mode, all inputs
-    BMSUtil::SendDataWithReply(payload, 3, true, buff, 3);
-    
-    payload[1] = 0x31;  // REG_IO_CTRL
-    payload[2] = 0b00000011;  // Enable temp measurement
-    BMSUtil::SendDataWithReply(payload, 3, true, buff, 3);
+    // Cell voltages (original scaling factors preserved)
+    for (int i = 0; i < 6; i++) {
+        cellVolt[i] = CELL_COUNTS_TO_MV(buff[5 + (i * 2)] * 256 + buff[6 + (i * 2)]);
+        if (lowestCellVolt[i]  > cellVolt[i] && cellVolt[i] >= 500)
+            lowestCellVolt[i] = cellVolt[i];
+        if (highestCellVolt[i] < cellVolt[i])
+            highestCellVolt[i] = cellVolt[i];
+    }
     
-    payload[1] = 0x34;  // REG_ADC_CONV
-    payload[2] = 1;
-    BMSUtil::SendDataWithReply(payload, 3, true, buff, 3);
+    // Module voltage (sum of cells)
+    moduleVolt = 0;
+    for (int i = 0; i < 6; i++) moduleVolt += cellVolt[i];
     
-    // Read data
-    payload[1] = 0x01;  // REG_GPAI
-    payload[2] = 0x12;  // 18 bytes
-    retLen = BMSUtil::SendDataWithReply(payload, 3, false, buff, 22);
+    // Temperatures (Steinhart-Hart table), TS2 scaled onto the TS1 divider
+    temperatures[0] = ThermistorTemp((uint32_t)buff[17] * 256 + buff[18]);
+    temperatures[1] = ThermistorTemp(((uint32_t)buff[19] * 256 + buff[20] + 9) * 33046 / 33068 - 2);
     
-    calcCRC = BMSUtil::GenCRC(buff, retLen - 1);
+    if (getLowTemp()  < lowestTemperature)  lowestTemperature  = getLowTemp();
+    if (getHighTemp() > highestTemperature) highestTemperature = getHighTemp();
     
-    if ((retLen == 22) && (buff[21] == calcCRC))
-    {
-        if (buff[0] == (moduleAddress << 1) && buff[1] == 0x01 && buff[2] == 0x12)
-        {
-            // Cell voltages (original scaling factors preserved)
-            for (int i = 0; i < 6; i++) {
-                cellVolt[i] = (buff[5 + (i * 2)] * 256 + buff[6 + (i * 2)]) * 0.000381493f;
-                if (lowestCellVolt[i]  > cellVolt[i] && cellVolt[i] >= 0.5f)
-                    lowestCellVolt[i] = cellVolt[i];
-                if (highestCellVolt[i] < cellVolt[i])
-                    highestCellVolt[i] = cellVolt[i];
-            }
-            
-            // Module voltage (sum of cells)
-            moduleVolt = 0;
-            for (int i = 0; i < 6; i++) moduleVolt += cellVolt[i];
-            
-            // Temperatures (Steinhart-Hart)
-            float tempTemp = (1.78f / ((buff[17] * 256 + buff[18] + 2) / 33046.0f) - 3.57f) * 1000.0f;
-            //float tempCalc = 1.0f / (0.0007610373573f + (0.0002728524832f * logf(tempTemp)) + (powf(logf(tempTemp), 3) * 0.0000001022822735f));
-            //temperatures[0] = tempCalc - 273.15f;
-            
-            tempTemp = (1.78f / ((buff[19] * 256 + buff[20] + 9) / 33068.0f) - 3.57f) * 1000.0f;
-            //tempCalc = 1.0f / (0.0007610373573f + (0.0002728524832f * logf(tempTemp)) + (powf(logf(tempTemp), 3) * 0.0000001022822735f));
-            //temperatures[1] = tempCalc - 273.15f;
-            
-            if (getLowTemp()  < lowestTemperature)  lowestTemperature  = getLowTemp();
-            if (getHighTemp() > highestTemperature) highestTemperature = getHighTemp();
-            
-            return true;
-        }
-    }
-    
-    return false;
+    return true;
 }
 
-float TeslaBMSModule::getCellVoltage(int cell)
+int TeslaBMSModule::getCellVoltage(int cell)
 {
-    if (cell < 0 || cell > 5) return 0.0f;
+    if (cell < 0 || cell > 5) return 0;
     return cellVolt[cell];
 }
 
-float TeslaBMSModule::getLowCellV()
+int TeslaBMSModule::getLowCellV()
 {
-    float lowVal = 10.0f;
+    int lowVal = 10000;
     for (int i = 0; i < 6; i++)
-        if (cellVolt[i] < lowVal && cellVolt[i] > 0.5f) lowVal = cellVolt[i];
+        if (cellVolt[i] < lowVal && cellVolt[i] > 500) lowVal = cellVolt[i];
     return lowVal;
 }
 
-float TeslaBMSModule::getHighCellV()
+int TeslaBMSModule::getHighCellV()
 {
-    float hiVal = 0.0f;
+    int hiVal = 0;
     for (int i = 0; i < 6; i++)
-        if (cellVolt[i] > hiVal && cellVolt[i] < 4.5f) hiVal = cellVolt[i];
+        if (cellVolt[i] > hiVal && cellVolt[i] < 4500) hiVal = cellVolt[i];
     return hiVal;
 }
 
-float TeslaBMSModule::getAverageV()
+int   TeslaBMSModule::getNumCells()       { return 6; }
+int   TeslaBMSModule::getModuleVoltage()  { return moduleVolt; }
+int   TeslaBMSModule::getTemperature(int temp)
 {
-    int   x = 0;
-    float avgVal = 0.0f;
-    for (int i = 0; i < 6; i++) {
-        if (cellVolt[i] > 0.5f && cellVolt[i] < 60.0f) {
-            x++;
-            avgVal += cellVolt[i];
-        }
-    }
-    if (scells != x) {
-        if (smiss > 2) scells = x;
-        else           smiss++;
-    } else {
-        scells = x;
-        smiss  = 0;
-    }
-    return (x > 0) ? avgVal / x : 0.0f;
-}
-
-int   TeslaBMSModule::getNumCells()       { return scells; }
-float TeslaBMSModule::getModuleVoltage()  { return moduleVolt; }
-float TeslaBMSModule::getTemperature(int temp)
-{
-    if (temp < 0 || temp > 1) return 0.0f;
+    if (temp < 0 || temp > 1) return 0;
     return temperatures[temp];
 }
 
-float TeslaBMSModule::getLowTemp()
+int TeslaBMSModule::getLowTemp()
 {
     return (temperatures[0] < temperatures[1]) ? temperatures[0] : temperatures[1];
 }
 
-float TeslaBMSModule::getHighTemp()
+int TeslaBMSModule::getHighTemp()
 {
     return (temperatures[0] < temperatures[1]) ? temperatures[1] : temperatures[0];
 }
 
-float TeslaBMSModule::getAvgTemp()
+int TeslaBMSModule::getAvgTemp()
 {
-    return (temperatures[0] + temperatures[1]) * 0.5f;
+    return (temperatures[0] + temperatures[1]) / 2;
 }
 
 uint8_t TeslaBMSModule::getFaults()    { return faults; }
@@ -225,173 +228,571 @@ uint8_t TeslaBMSModule::getCUVCells()  { return CUVFaults; }
 void    TeslaBMSModule::setAddress(int newAddr) { if (newAddr >= 0 && newAddr <= 0x3E) moduleAddress = (uint8_t)newAddr; }
 int     TeslaBMSModule::getAddress()   { return moduleAddress; }
 bool    TeslaBMSModule::isExisting()   { return exists; }
-void    TeslaBMSModule::setExists(bool ex) { exists = ex; }
+void    TeslaBMSModule::setExists(bool ex) { exists = ex; configured = false; misses = 0; }
+BMSUtil::LinkStats *TeslaBMSModule::getLink() { return &link; }
+/** Count value reads failed in a row, true once the module should be given up on */
+bool TeslaBMSModule::lostContact(bool ok)
+{
+    misses = ok ? 0 : MIN(misses + 1, 255);
+    return misses >= 5;
+}
+
+bool    TeslaBMSModule::isConfigured() { return configured; }
+void    TeslaBMSModule::setConfigured(bool cfg) { configured = cfg; }
 
 /* -----------------------------------------------------------------------
  * TeslaBMSManager implementation
+ *
+ * Task10Ms() runs one bus transaction per tick and never waits on the bus:
+ * it picks up the reply of the request it sent on the previous tick, then
+ * sends the next one. A scan cycle is
+ *   ADC conversion -> per module alerts + values -> publish -> balance
+ * While cells are balancing the bleed resistors stay on across cycles and
+ * only every TSLA_BAL_WINDOW cycles a measurement window opens:
+ *   balance off (broadcast) -> settle -> conversion -> masks back on
+ *   -> per module reads
+ * The values are latched by the conversion, so balancing resumes before
+ * the reads. Balance registers are only written where they differ from
+ * what the module should have.
+ * Discovery, renumbering and fault clearing are queued as jobs and run in
+ * place of a scan cycle. Every TSLA_HUNT_CYCLES cycles a short hunt checks
+ * one missing address and address 0, so modules that dropped off or were
+ * swapped in come back without a reset of the chain. A module whose value
+ * reads keep failing is dropped from the scan.
+ * ADC and IO control are only written to modules that were not configured
+ * since their last reset. Alert and fault status is read every StatPoll
+ * cycles, and every cycle for a module that reported a fault.
+ * The module turnaround is measured on every good reply from the time the
+ * request went out to the idle line after the reply, less the wire time.
+ * It is published for diagnosis only: a reply takes well under a millisecond,
+ * so the reply window stays at one 10 ms tick and a resend waits one tick
+ * more for every failed attempt.
  * ----------------------------------------------------------------------- */
+#define TSLA_BCAST           0x3F
+#define TSLA_ATTEMPTS        3     // sends per request before giving up
+#define TSLA_REPLY_TICKS     1     // replies are in wire time, one tick is plenty
+#define TSLA_RESET_TICKS     10    // 100 ms for the chain to come out of reset
+#define TSLA_CYCLE_TICKS     10    // scan at most every 100 ms
+#define TSLA_HUNT_CYCLES     10
+#define TSLA_BAL_WINDOW      10    // cycles between measurement windows while balancing
+#define TSLA_BAL_SETTLE      2     // ticks for the cells to relax after the bleed stops
+#define TSLA_BAL_TIME        50    // REG_BAL_TIME, seconds until the module stops on its own
+#define TSLA_BAL_REFRESH     20    // windows between REG_BAL_TIME refreshes
+
+enum TeslaState
+{
+    TS_IDLE,
+    TS_FIND,        // read REG_DEV_STATUS on addresses 1..MAX_MODULES
+    TS_RESET,       // broadcast reset, all modules fall back to address 0
+    TS_SETTLE,
+    TS_HUNT,        // read REG_DEV_STATUS on one missing address
+    TS_PROBE,       // is there still a module on address 0
+    TS_ASSIGN,      // give it the next free address
+    TS_CLEAR,       // clear alert and fault status, four broadcast writes
+    TS_BAL_OFF,
+    TS_WINDOW,      // bleed is off, wait for the cells to settle
+    TS_ADC_CTRL,
+    TS_IO_CTRL,
+    TS_ADC_CONV,
+    TS_ALERTS,
+    TS_VALUES,
+    TS_BAL_DUTY,
+    TS_BAL_MASK
+};
+
+static TeslaState tsState = TS_IDLE;
+static int     tsModule = 0;       // module (or step) the current state works on
+static bool    tsConvertEach = false;
+static bool    tsPollStatus = false;
+static int     tsStatusCycle = 0;
+static bool    tsBalancing = false;
+static int     tsBalCycle = 0;
+static int     tsBalWindows = 0;
+static uint8_t tsWantMask[MAX_MODULES + 1];  // balance mask each module should run
+static uint8_t tsChipMask[MAX_MODULES + 1];  // balance mask last written to it
+static bool    tsTimeSent[MAX_MODULES + 1];  // REG_BAL_TIME is current
+static int     tsResume = TS_IDLE;           // where to continue after a balance sync
+static int     tsResumeModule = 0;
+static bool    tsBusy = false;     // request out, reply not handled yet
+static uint8_t tsRequest[3];
+static bool    tsWrite = false;
+static int     tsReplyLen = 0;
+static int     tsAttempts = 0;
+static int     tsBackoff = 0;      // ticks to wait before resending a failed request
+static int     tsLatencyUs = 500;  // module turnaround beyond wire time, filtered
+static BMSUtil::LinkStats busLink; // broadcast and address 0 requests
+static int     tsWaitTicks = 0;
+static int     tsCycleTicks = 0;
+static int     tsHuntCycle = 0;
+static int     tsHuntAddr = 0;
+static bool    tsFindJob = false;
+static bool    tsRenumberJob = false;
+static bool    tsClearJob = false;
+static uint8_t tsReply[24];
+
 void TeslaBMSManager::Init()
 {
     for (int i = 1; i <= MAX_MODULES; i++) {
         modules[i].setExists(false);
         modules[i].setAddress(i);
     }
+    tsState = TS_IDLE;
+    tsBusy = false;
+    tsBackoff = 0;
+    tsFindJob = true;
     initialized = true;
 }
 
-void TeslaBMSManager::SetupBoards()
+void TeslaBMSManager::Task10Ms()
 {
-    uint8_t payload[3], buff[10];
-    int retLen;
+    if (!initialized) return;
     
-    while (1) {
-        payload[0] = 0; payload[1] = 0; payload[2] = 1;
-        retLen = BMSUtil::SendDataWithReply(payload, 3, false, buff, 4);
-        if (retLen == 4 && buff[0] == 0x80 && buff[1] == 0 && buff[2] == 1) {
-            for (int y = 1; y <= MAX_MODULES; y++) {
-                if (!modules[y].isExisting()) {
-                    payload[0] = 0;
-                    payload[1] = 0x3B;  // REG_ADDR_CTRL
-                    payload[2] = y | 0x80;
-                    BMSUtil::SendData(payload, 3, true);
-                    uDelay(3 * 1000);
-                    if (BMSUtil::GetReply(buff, 10) > 2) {
-                        if (buff[0] == 0x81 && buff[1] == 0x3B && buff[2] == (y + 0x80)) {
-                            modules[y].setExists(true);
-                            numFoundModules++;
-                        }
-                    }
-                    break;
-                }
-            }
-        } else break;
+    tsCycleTicks++;
+    
+    if (tsBackoff > 0) {
+        if (--tsBackoff == 0) Send();
+        return;
+    }
+    
+    if (tsBusy) {
+        int retLen, result;
+        bool retry;
+        
+        if (!BMSUtil::ReplyComplete(tsReplyLen) && ++tsWaitTicks <= TSLA_REPLY_TICKS)
+            return;
+        retLen = BMSUtil::ReadReply(tsReply, tsReplyLen);
+        tsBusy = false;
+        
+        result = BMSUtil::CheckReply(tsReply, retLen, tsReplyLen);
+        if (result == BMSUtil::REPLY_OK) MeasureLatency();
+        
+        // Each failed attempt waits one tick longer before it goes out again
+        retry = result != BMSUtil::REPLY_OK && ++tsAttempts < TSLA_ATTEMPTS;
+        BMSUtil::CountReply(LinkOf(tsRequest[0] >> 1), result, !retry);
+        if (retry) {
+            tsBackoff = tsAttempts;
+            return;
+        }
+        HandleReply(result == BMSUtil::REPLY_OK ? retLen : 0);
     }
+    
+    NextRequest();
+}
+
+void TeslaBMSManager::FindModules()     { tsFindJob = true; }
+void TeslaBMSManager::RenumberModules() { tsRenumberJob = true; }
+void TeslaBMSManager::ClearFaults()     { tsClearJob = true; }
+bool TeslaBMSManager::IsBusy()          { return tsState != TS_IDLE || tsFindJob || tsRenumberJob || tsClearJob; }
+
+void TeslaBMSManager::Request(uint8_t addr, uint8_t reg, uint8_t data, bool isWrite, int replyLen)
+{
+    tsRequest[0] = addr << 1;
+    tsRequest[1] = reg;
+    tsRequest[2] = data;
+    tsWrite = isWrite;
+    tsReplyLen = replyLen;
+    tsAttempts = 0;
+    Send();
 }
 
-void TeslaBMSManager::FindModules()
+void TeslaBMSManager::Send()
 {
-    uint8_t payload[3], buff[8];
-    numFoundModules = 0;
+    uint8_t payload[3];
     
-    for (int x = 1; x <= MAX_MODULES; x++) {
-        modules[x].setExists(false);
-        payload[0] = x << 1;
-        payload[1] = 0;
-        payload[2] = 1;
-        BMSUtil::SendData(payload, 3, false);
-        uDelay(20 * 1000);
-        if (BMSUtil::GetReply(buff, 8) > 4) {
-            if (buff[0] == (x << 1) && buff[1] == 0 && buff[2] == 1 && buff[4] > 0) {
-                modules[x].setExists(true);
-                numFoundModules++;
-            }
-        }
-        uDelay(5 * 1000);
+    // SendData sets the write bit in place, keep the stored request clean for retries
+    for (int i = 0; i < 3; i++) payload[i] = tsRequest[i];
+    BMSUtil::SendData(payload, 3, tsWrite);
+    tsWaitTicks = 0;
+    tsBusy = true;
+}
+
+/** Wire time of request and reply in us, the request carries a CRC when it is a write */
+int TeslaBMSManager::WireTimeUs()
+{
+    return (3 + tsWrite + tsReplyLen) * BMS_BYTE_US;
+}
+
+void TeslaBMSManager::MeasureLatency()
+{
+    int replyUs = BMSUtil::ReplyTimeUs();
+    
+    // Replies that filled up without the line going idle yet carry no time
+    if (replyUs < 0) return;
+    tsLatencyUs += (MAX(replyUs - WireTimeUs(), 0) - tsLatencyUs) / 8;
+    Param::SetInt(Param::TslaLatency, tsLatencyUs);
+}
+
+BMSUtil::LinkStats *TeslaBMSManager::LinkOf(int addr)
+{
+    return (addr >= 1 && addr <= MAX_MODULES) ? modules[addr].getLink() : &busLink;
+}
+
+/** Next address after from that has no module, wrapping around, 0 when all are present */
+int TeslaBMSManager::NextMissing(int from)
+{
+    for (int i = 1; i <= MAX_MODULES; i++) {
+        int y = (from + i - 1) % MAX_MODULES + 1;
+        if (!modules[y].isExisting()) return y;
+    }
+    return 0;
+}
+
+int TeslaBMSManager::NextModule(int from)
+{
+    for (int y = from + 1; y <= MAX_MODULES; y++)
+        if (modules[y].isExisting()) return y;
+    return 0;
+}
+
+/** Next module whose balance registers differ from what it should run */
+int TeslaBMSManager::NextBalanceSync(int from)
+{
+    for (int y = NextModule(from); y != 0; y = NextModule(y))
+        if (tsChipMask[y] != tsWantMask[y] || (tsWantMask[y] && !tsTimeSent[y])) return y;
+    return 0;
+}
+
+int TeslaBMSManager::BalanceState(int y)
+{
+    return (tsWantMask[y] && !tsTimeSent[y]) ? TS_BAL_DUTY : TS_BAL_MASK;
+}
+
+/** Write the balance registers that changed, then continue with state next */
+void TeslaBMSManager::SyncBalance(int next, int nextModule)
+{
+    tsResume = next;
+    tsResumeModule = nextModule;
+    tsModule = NextBalanceSync(0);
+    
+    if (tsModule != 0) {
+        tsState = (TeslaState)BalanceState(tsModule);
+    } else {
+        tsState = (TeslaState)next;
+        tsModule = nextModule;
     }
 }
 
-void TeslaBMSManager::RenumberModules()
+void TeslaBMSManager::UpdateBalance()
 {
-    uint8_t payload[3], buff[8];
-    int attempts = 1;
+    int balanceVmV = Param::GetInt(Param::Vbalance);
+    bool wanted = Param::GetInt(Param::balance) && 
+                  highCellVolt > balanceVmV &&
+                  (highCellVolt - lowCellVolt) > 40;
     
+    tsBalancing = false;
     for (int y = 1; y <= MAX_MODULES; y++) {
-        modules[y].setExists(false);
-        numFoundModules = 0;
+        tsWantMask[y] = (wanted && modules[y].isExisting()) ? BalanceMask(y) : 0;
+        if (tsWantMask[y] != 0) tsBalancing = true;
     }
+    if (!tsBalancing) tsBalCycle = 0;
+}
+
+uint8_t TeslaBMSManager::BalanceMask(int y)
+{
+    uint8_t balance = 0;
     
-    while (attempts < 3) {
-        payload[0] = 0x3F << 1;
-        payload[1] = 0x3C;
-        payload[2] = 0xA5;
-        BMSUtil::SendData(payload, 3, true);
-        uDelay(100 * 1000);
-        BMSUtil::GetReply(buff, 8);
-        if (buff[0] == 0x7F && buff[1] == 0x3C && buff[2] == 0xA5 && buff[3] == 0x57) break;
-        attempts++;
-    }
+    for (int i = 0; i < 6; i++)
+        if (lowCellVolt < modules[y].getCellVoltage(i))
+            balance |= (1 << i);
+    return balance;
+}
+
+void TeslaBMSManager::StartCycle()
+{
+    tsCycleTicks = 0;
+    Param::SetInt(Param::TslaModules, numFoundModules);
     
-    SetupBoards();
+    if (tsRenumberJob) {
+        tsRenumberJob = false;
+        tsFindJob = false;
+        tsState = TS_RESET;
+    } else if (tsFindJob || numFoundModules == 0) {
+        // Nothing to scan yet, keep looking for modules in the background
+        tsFindJob = false;
+        numFoundModules = 0;
+        tsModule = 1;
+        tsState = TS_FIND;
+    } else if (tsClearJob) {
+        tsClearJob = false;
+        tsModule = 0;
+        tsState = TS_CLEAR;
+    } else if (++tsHuntCycle >= TSLA_HUNT_CYCLES) {
+        tsHuntCycle = 0;
+        tsModule = NextMissing(tsHuntAddr);
+        tsState = tsModule != 0 ? TS_HUNT : TS_PROBE;
+    } else if (tsBalancing && ++tsBalCycle < TSLA_BAL_WINDOW) {
+        // Keep bleeding, nothing to send
+        tsState = TS_IDLE;
+    } else if (tsBalancing) {
+        tsBalCycle = 0;
+        if (++tsBalWindows >= TSLA_BAL_REFRESH) {
+            tsBalWindows = 0;
+            for (int y = 1; y <= MAX_MODULES; y++) tsTimeSent[y] = false;
+        }
+        tsState = TS_BAL_OFF;
+    } else {
+        StartScan();
+    }
 }
 
-void TeslaBMSManager::ClearFaults()
+void TeslaBMSManager::StartScan()
 {
-    uint8_t payload[3], buff[8];
+    tsConvertEach = !Param::GetInt(Param::BcastAdc);
+    tsPollStatus = ++tsStatusCycle >= Param::GetInt(Param::StatPoll);
+    if (tsPollStatus) tsStatusCycle = 0;
+    tsModule = NextModule(0);
     
-    payload[0] = 0x7F; payload[1] = 0x20; payload[2] = 0xFF;
-    BMSUtil::SendDataWithReply(payload, 3, true, buff, 4);
-    payload[2] = 0x00;
-    BMSUtil::SendDataWithReply(payload, 3, true, buff, 4);
+    // A module that lost its configuration lost its balance timer as well
+    for (int y = tsModule; y != 0; y = NextModule(y))
+        if (!modules[y].isConfigured()) tsTimeSent[y] = false;
     
-    payload[1] = 0x21; payload[2] = 0xFF;
-    BMSUtil::SendDataWithReply(payload, 3, true, buff, 4);
-    payload[2] = 0x00;
-    BMSUtil::SendDataWithReply(payload, 3, true, buff, 4);
+    if (tsConvertEach)
+        tsState = (TeslaState)ModuleState(tsModule);
+    else
+        tsState = AllConfigured() ? TS_ADC_CONV : TS_ADC_CTRL;
 }
 
-void TeslaBMSManager::StopBalancing()
+/** First state for module y, configures and converts it when not broadcasting */
+int TeslaBMSManager::ModuleState(int y)
 {
-    for (int x = 1; x <= MAX_MODULES; x++)
-        if (modules[x].isExisting()) modules[x].stopBalance();
+    if (tsConvertEach)
+        return modules[y].isConfigured() ? TS_ADC_CONV : TS_ADC_CTRL;
+    return ReadState(y);
 }
 
-void TeslaBMSManager::BalanceCells()
+/** Status is only read on polling cycles or while the module reports a fault */
+int TeslaBMSManager::ReadState(int y)
 {
-    uint8_t payload[4], buff[30], balance;
-    int balanceDuty = Param::GetInt(Param::balance) ? 50 : 0;
+    return (tsPollStatus || modules[y].hasFault()) ? TS_ALERTS : TS_VALUES;
+}
+
+bool TeslaBMSManager::AllConfigured()
+{
+    for (int y = NextModule(0); y != 0; y = NextModule(y))
+        if (!modules[y].isConfigured()) return false;
+    return true;
+}
+
+/** Send the request for the current state, or move on if it has none */
+void TeslaBMSManager::NextRequest()
+{
+    uint8_t addr = tsConvertEach ? tsModule : TSLA_BCAST;
     
-    for (int y = 1; y <= MAX_MODULES; y++) {
-        if (!modules[y].isExisting()) continue;
-        balance = 0;
-        for (int i = 0; i < 6; i++)
-            if (lowCellVolt < modules[y].getCellVoltage(i))
-                balance |= (1 << i);
-        
-        if (balance != 0) {
-            payload[0] = y << 1; payload[1] = 0x33; payload[2] = (uint8_t)balanceDuty;
-            BMSUtil::SendData(payload, 3, true); uDelay(2 * 1000); BMSUtil::GetReply(buff, 30);
-            
-            payload[1] = 0x32; payload[2] = balance;
-            BMSUtil::SendData(payload, 3, true); uDelay(2 * 1000); BMSUtil::GetReply(buff, 30);
-        }
+    switch (tsState) {
+    case TS_IDLE:
+        if (tsCycleTicks >= TSLA_CYCLE_TICKS) StartCycle();
+        break;
+    case TS_FIND:
+    case TS_HUNT:
+        Request(tsModule, 0, 1, false, 5);
+        break;
+    case TS_RESET:
+        Request(TSLA_BCAST, 0x3C, 0xA5, true, 4);  // REG_RESET
+        break;
+    case TS_SETTLE:
+        if (--tsWaitTicks <= 0) tsState = TS_PROBE;
+        break;
+    case TS_PROBE:
+        Request(0, 0, 1, false, 5);
+        break;
+    case TS_ASSIGN:
+        Request(0, 0x3B, tsModule | 0x80, true, 4);  // REG_ADDR_CTRL
+        break;
+    case TS_CLEAR:
+        // 0x20 REG_ALERT_STATUS, 0x21 REG_FAULT_STATUS, each set then cleared
+        Request(TSLA_BCAST, 0x20 + (tsModule >> 1), (tsModule & 1) ? 0x00 : 0xFF, true, 4);
+        break;
+    case TS_BAL_OFF:
+        Request(TSLA_BCAST, 0x32, 0, true, 4);  // REG_BAL_CTRL
+        break;
+    case TS_ADC_CTRL:
+        Request(addr, 0x30, 0b00111101, true, 4);  // Auto mode, all inputs
+        break;
+    case TS_IO_CTRL:
+        Request(addr, 0x31, 0b00000011, true, 4);  // Enable temp measurement
+        break;
+    case TS_ADC_CONV:
+        Request(addr, 0x34, 1, true, 4);
+        break;
+    case TS_ALERTS:
+        Request(tsModule, 0x20, 0x04, false, 8);  // REG_ALERT_STATUS
+        break;
+    case TS_VALUES:
+        Request(tsModule, 0x01, 0x12, false, 22);  // REG_GPAI, 18 bytes
+        break;
+    case TS_WINDOW:
+        if (--tsWaitTicks <= 0) StartScan();
+        break;
+    case TS_BAL_DUTY:
+        Request(tsModule, 0x33, TSLA_BAL_TIME, true, 4);  // REG_BAL_TIME
+        break;
+    case TS_BAL_MASK:
+        Request(tsModule, 0x32, tsWantMask[tsModule], true, 4);  // REG_BAL_CTRL
+        break;
     }
 }
 
-void TeslaBMSManager::GetAllVoltTemp()
+/** Consume the reply to the last request and advance the state */
+void TeslaBMSManager::HandleReply(int retLen)
 {
-    packVolt = 0.0f;
-    
-    for (int x = 1; x <= MAX_MODULES; x++)
-        if (modules[x].isExisting()) modules[x].stopBalance();
+    bool echoOk = retLen >= 3 && tsReply[1] == tsRequest[1] && tsReply[2] == tsRequest[2];
     
-    //osDelay(numFoundModules < 8 ? 200 : 50);
+    switch (tsState) {
+    case TS_FIND:
+        if (retLen > 4 && tsReply[0] == (tsModule << 1) && echoOk && tsReply[4] > 0) {
+            modules[tsModule].setExists(true);
+            numFoundModules++;
+        } else {
+            modules[tsModule].setExists(false);
+        }
+        // Then hand out addresses to anything still sitting on address 0
+        if (++tsModule > MAX_MODULES) tsState = TS_PROBE;
+        break;
+    case TS_HUNT:
+        if (retLen > 4 && tsReply[0] == (tsModule << 1) && echoOk && tsReply[4] > 0) {
+            modules[tsModule].setExists(true);
+            numFoundModules++;
+        }
+        tsHuntAddr = tsModule;
+        tsState = TS_PROBE;
+        break;
+    case TS_RESET:
+        for (int y = 1; y <= MAX_MODULES; y++) modules[y].setExists(false);
+        numFoundModules = 0;
+        tsWaitTicks = TSLA_RESET_TICKS;
+        tsState = TS_SETTLE;
+        break;
+    case TS_PROBE:
+        tsModule = 0;
+        if (retLen == 5 && tsReply[0] == 0x80 && echoOk)
+            for (int y = MAX_MODULES; y >= 1; y--)
+                if (!modules[y].isExisting()) tsModule = y;
+        tsState = tsModule != 0 ? TS_ASSIGN : TS_IDLE;
+        break;
+    case TS_ASSIGN:
+        if (retLen > 2 && tsReply[0] == 0x81 && echoOk) {
+            modules[tsModule].setExists(true);
+            numFoundModules++;
+        }
+        tsState = TS_PROBE;
+        break;
+    case TS_CLEAR:
+        if (++tsModule >= 4) tsState = TS_IDLE;
+        break;
+    case TS_BAL_OFF:
+        // Without the echo some modules may still bleed, keep their masks so the sync writes them
+        if (retLen == tsReplyLen)
+            for (int y = 1; y <= MAX_MODULES; y++) tsChipMask[y] = 0;
+        tsWaitTicks = TSLA_BAL_SETTLE;
+        tsState = TS_WINDOW;
+        break;
+    case TS_ADC_CTRL:
+        tsState = TS_IO_CTRL;
+        break;
+    case TS_IO_CTRL:
+        if (retLen == tsReplyLen) {
+            if (tsConvertEach)
+                modules[tsModule].setConfigured(true);
+            else
+                for (int y = NextModule(0); y != 0; y = NextModule(y))
+                    modules[y].setConfigured(true);
+        }
+        tsState = TS_ADC_CONV;
+        break;
+    case TS_ADC_CONV:
+        // No broadcast echo, convert module by module for the rest of this cycle
+        if (!tsConvertEach && retLen != tsReplyLen) {
+            tsConvertEach = true;
+            tsState = (TeslaState)ModuleState(tsModule);
+        } else if (!tsConvertEach && tsBalancing) {
+            // Values are latched, put the bleed back on before reading them
+            SyncBalance(ReadState(tsModule), tsModule);
+        } else {
+            tsState = (TeslaState)ReadState(tsModule);
+        }
+        break;
+    case TS_ALERTS:
+        if (retLen == 8) modules[tsModule].decodeStatus(tsReply);
+        tsState = TS_VALUES;
+        break;
+    case TS_VALUES:
+        // No valid answer, the module may have been reset, configure it again
+        if (!modules[tsModule].decodeValues(tsReply, retLen)) {
+            modules[tsModule].setConfigured(false);
+            if (modules[tsModule].lostContact(false)) {
+                modules[tsModule].setExists(false);
+                numFoundModules--;
+                ErrorMessage::Post(ERR_MODULELOST);
+            }
+        } else {
+            modules[tsModule].lostContact(true);
+        }
+        tsModule = NextModule(tsModule);
+        if (tsModule != 0) {
+            tsState = (TeslaState)ModuleState(tsModule);
+        } else {
+            EndCycle();
+        }
+        break;
+    case TS_BAL_DUTY:
+        if (retLen == tsReplyLen) tsTimeSent[tsModule] = true;
+        tsState = TS_BAL_MASK;
+        break;
+    case TS_BAL_MASK:
+        // A failed write stays out of sync and is tried again on the next sync
+        if (retLen == tsReplyLen) tsChipMask[tsModule] = tsWantMask[tsModule];
+        tsModule = NextBalanceSync(tsModule);
+        if (tsModule != 0) {
+            tsState = (TeslaState)BalanceState(tsModule);
+        } else {
+            tsState = (TeslaState)tsResume;
+            tsModule = tsResumeModule;
+        }
+        break;
+    default:
+        tsState = TS_IDLE;
+        break;
+    }
+}
+
+/** All modules read, publish and decide whether to balance until the next cycle */
+void TeslaBMSManager::EndCycle()
+{
+    Aggregate();
+    PublishToParams();
+    PublishLinkStats();
     
+    UpdateBalance();
+    SyncBalance(TS_IDLE, 0);
+}
+
+void TeslaBMSManager::Aggregate()
+{
+    packVolt = 0;
     totalCells = 0;
+    highCellVolt = 0;
+    lowCellVolt  = 5000;
+    numCells = 0;
     for (int x = 1; x <= MAX_MODULES; x++) {
         if (!modules[x].isExisting()) continue;
-        modules[x].readModuleValues();
+        for (int c = 0; c < 6; c++)
+            cells[numCells++] = modules[x].getCellVoltage(c);
         packVolt += modules[x].getModuleVoltage();
         totalCells += modules[x].getNumCells();
-    }
-    
-    highCellVolt = 0.0f;
-    lowCellVolt  = 5.0f;
-    for (int x = 1; x <= MAX_MODULES; x++) {
-        if (!modules[x].isExisting()) continue;
         if (modules[x].getHighCellV() > highCellVolt) highCellVolt = modules[x].getHighCellV();
         if (modules[x].getLowCellV()  < lowCellVolt)  lowCellVolt  = modules[x].getLowCellV();
     }
     
     // Temperature aggregates
-    lowTemp  = 999.0f;
-    highTemp = -999.0f;
-    avgTemp  = 0.0f;
+    lowTemp  = 9990;
+    highTemp = -9990;
+    avgTemp  = 0;
     int validTempCount = 0;
     
     for (int x = 1; x <= MAX_MODULES; x++) {
         if (!modules[x].isExisting()) continue;
-        float modTemp = modules[x].getAvgTemp();
-        if (modTemp > -70) {
+        int modTemp = modules[x].getAvgTemp();
+        if (modTemp > -700) {
             avgTemp += modTemp;
             if (modules[x].getHighTemp() > highTemp) highTemp = modules[x].getHighTemp();
             if (modules[x].getLowTemp()  < lowTemp)  lowTemp  = modules[x].getLowTemp();
@@ -404,74 +805,57 @@ void TeslaBMSManager::GetAllVoltTemp()
 void TeslaBMSManager::PublishToParams()
 {
     // Pack aggregates
-    Param::SetFloat(Param::udc,      packVolt);
-    Param::SetInt(Param::umin,       (int)(lowCellVolt * 1000.0f));
-    Param::SetInt(Param::umax,       (int)(highCellVolt * 1000.0f));
-    Param::SetInt(Param::deltaV,     (int)((highCellVolt - lowCellVolt) * 1000.0f));
-    Param::SetInt(Param::TempMax,    (int)highTemp);
-    Param::SetInt(Param::TempMin,    (int)lowTemp);
-    Param::SetInt(Param::Tempavg,    (int)avgTemp);
+    Param::SetFixed(Param::udc,      FP_FROMINT(packVolt) / 1000);
+    Param::SetInt(Param::umin,       lowCellVolt);
+    Param::SetInt(Param::umax,       highCellVolt);
+    Param::SetInt(Param::deltaV,     highCellVolt - lowCellVolt);
+    Param::SetFixed(Param::TempMax,  FP_FROMINT(highTemp) / 10);
+    Param::SetFixed(Param::TempMin,  FP_FROMINT(lowTemp) / 10);
+    Param::SetFixed(Param::Tempavg,  FP_FROMINT(avgTemp) / 10);
     Param::SetInt(Param::CellsPresent, totalCells);
     
-    // Publish first 20 cell voltages to u1..u20
-    int cellIdx = 0;
-    for (int m = 1; m <= MAX_MODULES && cellIdx < 20; m++) {
-        if (!modules[m].isExisting()) continue;
-        for (int c = 0; c < 6 && cellIdx < 20; c++) {
-            int mv = (int)(modules[m].getCellVoltage(c) * 1000.0f);
-            switch (cellIdx) {
-                case 0:  Param::SetInt(Param::u1,  mv); break;
-                case 1:  Param::SetInt(Param::u2,  mv); break;
-                case 2:  Param::SetInt(Param::u3,  mv); break;
-                case 3:  Param::SetInt(Param::u4,  mv); break;
-                case 4:  Param::SetInt(Param::u5,  mv); break;
-                case 5:  Param::SetInt(Param::u6,  mv); break;
-                case 6:  Param::SetInt(Param::u7,  mv); break;
-                case 7:  Param::SetInt(Param::u8,  mv); break;
-                case 8:  Param::SetInt(Param::u9,  mv); break;
-                case 9:  Param::SetInt(Param::u10, mv); break;
-                case 10: Param::SetInt(Param::u11, mv); break;
-                case 11: Param::SetInt(Param::u12, mv); break;
-                case 12: Param::SetInt(Param::u13, mv); break;
-                case 13: Param::SetInt(Param::u14, mv); break;
-                case 14: Param::SetInt(Param::u15, mv); break;
-                case 15: Param::SetInt(Param::u16, mv); break;
-                case 16: Param::SetInt(Param::u17, mv); break;
-                case 17: Param::SetInt(Param::u18, mv); break;
-                case 18: Param::SetInt(Param::u19, mv); break;
-                case 19: Param::SetInt(Param::u20, mv); break;
-            }
-            cellIdx++;
-        }
-    }
+    // Cell voltages in module order to u1..u120
+    for (int i = 0; i < numCells && i <= Param::u120 - Param::u1; i++)
+        Param::SetInt((Param::PARAM_NUM)(Param::u1 + i), cells[i]);
 }
 
-void TeslaBMSManager::Task100Ms()
+void TeslaBMSManager::PublishLinkStats()
 {
-    if (!initialized) return;
-    
-    GetAllVoltTemp();
+    // Counts are per scan cycle: published here and then cleared so they never wrap
+    uint32_t good = busLink.good, bad = busLink.bad, crcErrors = busLink.crcErrors;
+    uint32_t timeouts = busLink.timeouts, retries = busLink.retries;
+    int worst = 0, worstBad = 0;
     
-    // Cell balancing decision
-    int balanceVmV = Param::GetInt(Param::Vbalance);
-    if (Param::GetInt(Param::balance) && 
-        (highCellVolt * 1000.0f) > balanceVmV &&
-        (highCellVolt - lowCellVolt) > 0.04f) {
-        BalanceCells();
-    } else {
-        StopBalancing();
+    for (int y = 1; y <= MAX_MODULES; y++) {
+        BMSUtil::LinkStats *l = modules[y].getLink();
+        good      += l->good;
+        bad       += l->bad;
+        crcErrors += l->crcErrors;
+        timeouts  += l->timeouts;
+        retries   += l->retries;
+        // Link that needed the most help, counting retries so a weak link shows before it fails
+        if (modules[y].isExisting() && l->bad + l->retries > worstBad) {
+            worstBad = l->bad + l->retries;
+            worst = y;
+        }
+        memset(l, 0, sizeof(*l));
     }
+    memset(&busLink, 0, sizeof(busLink));
     
-    PublishToParams();
+    Param::SetInt(Param::TslaGood,    good);
+    Param::SetInt(Param::TslaBad,     bad);
+    Param::SetInt(Param::TslaCrcErr,  crcErrors);
+    Param::SetInt(Param::TslaTimeout, timeouts);
+    Param::SetInt(Param::TslaRetries, retries);
+    Param::SetInt(Param::TslaWorst,   worst);
 }
 
-// Accessors
-float TeslaBMSManager::GetPackVoltage()   { return packVolt; }
-float TeslaBMSManager::GetAvgCellVolt()   { return packVolt / (totalCells > 0 ? totalCells : 1); }
-float TeslaBMSManager::GetLowCellVolt()   { return lowCellVolt; }
-float TeslaBMSManager::GetHighCellVolt()  { return highCellVolt; }
-float TeslaBMSManager::GetAvgTemp()       { return avgTemp; }
-float TeslaBMSManager::GetLowTemp()       { return lowTemp; }
-float TeslaBMSManager::GetHighTemp()      { return highTemp; }
+int32_t TeslaBMSManager::GetPackVoltage() { return packVolt; }
+int   TeslaBMSManager::GetAvgCellVolt()   { return packVolt / (totalCells > 0 ? totalCells : 1); }
+int   TeslaBMSManager::GetLowCellVolt()   { return lowCellVolt; }
+int   TeslaBMSManager::GetHighCellVolt()  { return highCellVolt; }
+int   TeslaBMSManager::GetAvgTemp()       { return avgTemp; }
+int   TeslaBMSManager::GetLowTemp()       { return lowTemp; }
+int   TeslaBMSManager::GetHighTemp()      { return highTemp; }
 int   TeslaBMSManager::GetNumModules()    { return numFoundModules; }
 int   TeslaBMSManager::GetTotalCells()    { return totalCells; }
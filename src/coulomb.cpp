@@ -0,0 +1,294 @@
+/*
+ * This file is part of the RaVus BMS project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/stm32/flash.h>
+#include <libopencm3/stm32/desig.h>
+#include <libopencm3/stm32/crc.h>
+#include "coulomb.h"
+#include "params.h"
+#include "hwdefs.h"
+#include "my_math.h"
+
+#define CYCLES_PER_US        72
+#define COULOMB_HOLD_MS      1000       // longer gaps are not integrated
+#define COULOMB_STALE_TICKS  10         // 100 ms ticks without a frame before we forget the last one
+#define NC_PER_MAH           3600000LL
+#define NJ_PER_WH            3600000000000LL
+#define COULOMB_SAVE_MAH     1000       // log at least every Ah of throughput
+#define COULOMB_SAVE_SOC     FP_FROMINT(1) // or when SOC moved this far from the logged one
+#define COULOMB_SAVE_TICKS   600        // but no more than one record a minute
+#define COULOMB_MAGIC        0x4331     // "C1"
+#define RECORD_WORDS         8
+#define RECORDS_PER_PAGE     (FLASH_PAGE_SIZE / (RECORD_WORDS * 4))
+
+struct CoulombRecord
+{
+    uint16_t magic;
+    uint16_t seq;       // counts up across both pages, wraps
+    uint32_t mAhChg;
+    uint32_t mAhDis;
+    uint32_t whChg;
+    uint32_t whDis;
+    int32_t  soc;       // s32fp
+    uint32_t gaps;
+    uint32_t crc;
+};
+
+//Integrators, written from the CAN interrupt
+static int64_t netNc = 0;
+static int64_t chgNc = 0, disNc = 0;
+static int64_t chgNj = 0, disNj = 0;
+static uint32_t lastStamp = 0;
+static int32_t lastMa = 0;
+static bool haveLast = false;
+static uint8_t age = 0;
+static uint32_t gaps = 0;
+
+//Totals, updated from the 100 ms task
+static uint32_t mAhChg = 0, mAhDis = 0, whChg = 0, whDis = 0;
+static uint32_t savedMah = 0;
+static s32fp savedSoc = 0;
+static int sinceSave = 0;               // 100 ms ticks
+static int curPage = 0;                 // page holding the newest record
+static uint16_t seq = 0;                // of the newest record
+static volatile bool savePending = false;
+
+static uint32_t GetFlashAddress(int logPage)
+{
+    int blk = logPage == 0 ? COULOMB_BLKNUM : COULOMB_BLKNUM2;
+
+    return FLASH_BASE + desig_get_flash_size() * 1024 - blk * FLASH_PAGE_SIZE;
+}
+
+static uint32_t RecordCrc(const CoulombRecord* rec)
+{
+    crc_reset();
+    return crc_calculate_block((uint32_t*)rec, RECORD_WORDS - 1);
+}
+
+static bool IsBlank(const CoulombRecord* rec)
+{
+    const uint32_t* words = (const uint32_t*)rec;
+    uint32_t check = 0xFFFFFFFF;
+
+    for (int i = 0; i < RECORD_WORDS; i++)
+        check &= words[i];
+    return check == 0xFFFFFFFF;
+}
+
+static void Program(uint32_t address, const CoulombRecord* rec)
+{
+    for (int i = 0; i < RECORD_WORDS; i++)
+        flash_program_word(address + i * 4, ((const uint32_t*)rec)[i]);
+}
+
+static void Publish(Param::PARAM_NUM param, uint32_t milli)
+{
+    Param::SetFixed(param, FP_FROMINT(milli / 1000) + FP_FROMINT(milli % 1000) / 1000);
+}
+
+/** Restore the newest valid record of either page and start the cycle counter */
+void CoulombCounter::Init()
+{
+    const CoulombRecord* newest = 0;
+
+    dwt_enable_cycle_counter();
+
+    for (int p = 0; p < 2; p++)
+    {
+        const CoulombRecord* page = (const CoulombRecord*)GetFlashAddress(p);
+
+        for (int i = 0; i < RECORDS_PER_PAGE; i++)
+        {
+            if (page[i].magic != COULOMB_MAGIC || RecordCrc(&page[i]) != page[i].crc)
+                continue;
+            if (newest == 0 || (int16_t)(page[i].seq - newest->seq) > 0)
+            {
+                newest = &page[i];
+                curPage = p;
+            }
+        }
+    }
+
+    if (newest != 0)
+    {
+        seq = newest->seq;
+        mAhChg = newest->mAhChg;
+        mAhDis = newest->mAhDis;
+        whChg = newest->whChg;
+        whDis = newest->whDis;
+        gaps = newest->gaps;
+        Param::SetFixed(Param::SOC, newest->soc);
+    }
+    savedMah = mAhChg + mAhDis;
+    savedSoc = Param::Get(Param::SOC);
+}
+
+/** One current frame from the shunt, mA and pack mV. Called from the CAN interrupt */
+void CoulombCounter::AddSample(int32_t milliAmps, int32_t milliVolts)
+{
+    uint32_t now = dwt_read_cycle_counter();
+
+    if (haveLast)
+    {
+        uint32_t dtUs = (now - lastStamp) / CYCLES_PER_US;
+
+        if (dtUs > COULOMB_HOLD_MS * 1000)
+        {
+            gaps++;
+        }
+        else
+        {
+            int64_t dq = ((int64_t)lastMa + milliAmps) * dtUs / 2; //mA * us = nC
+            int64_t de = dq * milliVolts / 1000;                    //nC * V = nJ
+
+            netNc += dq;
+            if (dq >= 0)
+            {
+                chgNc += dq;
+                chgNj += de;
+            }
+            else
+            {
+                disNc -= dq;
+                disNj -= de;
+            }
+        }
+    }
+
+    lastStamp = now;
+    lastMa = milliAmps;
+    haveLast = true;
+    age = 0;
+}
+
+/** Roll the integrators into the totals, publish them and decide whether to log */
+void CoulombCounter::Task100Ms()
+{
+    cm_disable_interrupts();
+    if (haveLast && ++age > COULOMB_STALE_TICKS)
+    {
+        //Sensor went quiet, don't bridge the gap (or a cycle counter wrap) when it returns
+        haveLast = false;
+        gaps++;
+    }
+    mAhChg += chgNc / NC_PER_MAH;
+    chgNc %= NC_PER_MAH;
+    mAhDis += disNc / NC_PER_MAH;
+    disNc %= NC_PER_MAH;
+    whChg += chgNj / NJ_PER_WH;
+    chgNj %= NJ_PER_WH;
+    whDis += disNj / NJ_PER_WH;
+    disNj %= NJ_PER_WH;
+    cm_enable_interrupts();
+
+    Publish(Param::AhChg, mAhChg);
+    Publish(Param::AhDis, mAhDis);
+    Publish(Param::kWhChg, whChg);
+    Publish(Param::kWhDis, whDis);
+    Param::SetInt(Param::CoulGaps, gaps);
+
+    //A 32 record page and 10k erase cycles, the rate limit is what keeps the flash alive
+    if (sinceSave < COULOMB_SAVE_TICKS)
+    {
+        sinceSave++;
+    }
+    else if (ABS(Param::Get(Param::SOC) - savedSoc) >= COULOMB_SAVE_SOC || (mAhChg + mAhDis - savedMah) >= COULOMB_SAVE_MAH)
+    {
+        sinceSave = 0;
+        savePending = true;
+    }
+}
+
+/** Net charge since the last call in whole multiples of unitNc, the rest is kept */
+int32_t CoulombCounter::TakeCharge(int64_t unitNc)
+{
+    int32_t units;
+
+    if (unitNc <= 0) return 0;
+
+    cm_disable_interrupts();
+    units = netNc / unitNc;
+    netNc -= units * unitNc;
+    cm_enable_interrupts();
+
+    return units;
+}
+
+/** Append a record to the current log page. When that is full the record
+ * goes to the other page first and only then is the full one erased, so a
+ * power loss at any point leaves a valid record behind. Main loop only */
+void CoulombCounter::Save()
+{
+    CoulombRecord rec;
+    uint32_t address = GetFlashAddress(curPage);
+    const CoulombRecord* page = (const CoulombRecord*)address;
+    int slot;
+
+    if (!savePending) return;
+    savePending = false;
+
+    rec.magic = COULOMB_MAGIC;
+    rec.seq = seq + 1;
+    rec.mAhChg = mAhChg;
+    rec.mAhDis = mAhDis;
+    rec.whChg = whChg;
+    rec.whDis = whDis;
+    rec.soc = Param::Get(Param::SOC);
+    rec.gaps = gaps;
+    //We disable interrupts to prevent concurrent access of the CRC unit
+    cm_disable_interrupts();
+    rec.crc = RecordCrc(&rec);
+    cm_enable_interrupts();
+
+    for (slot = 0; slot < RECORDS_PER_PAGE; slot++)
+    {
+        if (IsBlank(&page[slot])) break;
+    }
+
+    flash_unlock();
+    if (slot < RECORDS_PER_PAGE)
+    {
+        Program(address + slot * sizeof(rec), &rec);
+    }
+    else
+    {
+        uint32_t fresh = GetFlashAddress(!curPage);
+        const CoulombRecord* other = (const CoulombRecord*)fresh;
+
+        //Only older records can be left there, by a switch that lost power before its erase
+        for (int i = 0; i < RECORDS_PER_PAGE; i++)
+        {
+            if (!IsBlank(&other[i]))
+            {
+                flash_erase_page(fresh);
+                break;
+            }
+        }
+        Program(fresh, &rec);
+        flash_erase_page(address);
+        curPage = !curPage;
+    }
+    flash_lock();
+
+    seq = rec.seq;
+
+    savedMah = rec.mAhChg + rec.mAhDis;
+    savedSoc = rec.soc;
+}
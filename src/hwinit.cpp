@@ -109,6 +109,7 @@ void clock_setup(void)
    rcc_periph_clock_enable(RCC_USART1);//Model S slaves
    rcc_periph_clock_enable(RCC_TIM2); //Scheduler
    rcc_periph_clock_enable(RCC_TIM3); //PWM outputs
+   rcc_periph_clock_enable(RCC_TIM4); //BATMan command gaps
    rcc_periph_clock_enable(RCC_DMA1);  //ADC, Encoder and UART receive
    rcc_periph_clock_enable(RCC_ADC1);
    rcc_periph_clock_enable(RCC_CRC);
@@ -171,6 +172,15 @@ void nvic_setup(void)
 {
    nvic_enable_irq(NVIC_TIM2_IRQ); //Scheduler
    nvic_set_priority(NVIC_TIM2_IRQ, 0xe << 4); //second lowest priority
+
+   nvic_enable_irq(NVIC_SPI1_IRQ); //BATMan transfer engine
+   nvic_set_priority(NVIC_SPI1_IRQ, 0xd << 4); //above the scheduler so sequences run in the background
+
+   nvic_enable_irq(NVIC_TIM4_IRQ); //BATMan command gaps
+   nvic_set_priority(NVIC_TIM4_IRQ, 0xd << 4);
+
+   nvic_enable_irq(NVIC_USART1_IRQ); //Tesla module bus, timestamps the end of a reply
+   nvic_set_priority(NVIC_USART1_IRQ, 0xd << 4);
 }
 
 void rtc_setup()
@@ -198,6 +208,21 @@ void spi1_setup()   //spi 1 used for BATMAN!
    spi_enable(SPI1);
 }
 
+/**
+* TIM4 counts microseconds in one-pulse mode, it times the gaps between BATMan commands
+*/
+void tim4_setup(void)
+{
+   timer_disable_counter(TIM4);
+   timer_one_shot_mode(TIM4);
+   timer_update_on_overflow(TIM4);
+   timer_set_prescaler(TIM4, (2 * rcc_apb1_frequency) / 1000000 - 1);
+   timer_set_period(TIM4, 0xFFFF);
+   timer_generate_event(TIM4, TIM_EGR_UG); //load prescaler
+   timer_clear_flag(TIM4, TIM_SR_UIF);
+   timer_enable_irq(TIM4, TIM_DIER_UIE);
+}
+
 void usart1_setup(void)
 {
 	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ, GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_USART1_TX);
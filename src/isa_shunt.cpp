@@ -15,6 +15,7 @@
 #include "my_math.h"
 #include "stm32_can.h"
 #include "params.h"
+#include "coulomb.h"
 
 uint16_t  framecount=0;
 bool firstframe=true;
@@ -31,18 +32,36 @@ int32_t ISA::Temperature;
 
 
 
-#define FLASH_DELAY 8000000
-static void delay(void) //delay used for isa setup fumction. probably much better ways but its used only once.......
+/* Commands to the sensor go through a small queue that Task10Ms() works off.
+ * Each one is sent on 0x411 and the next one waits until the sensor answers
+ * on 0x511 with the command byte echoed (bit 7 set) or the timeout runs out.
+ * STORE writes the sensor's flash so it gets a longer timeout. */
+#define ISA_CMD_ID       0x411
+#define ISA_REPLY_ID     0x511
+#define ISA_QUEUE_LEN    16
+#define ISA_TIMEOUT_MS   100
+#define ISA_STORE_MS     1000
+#define ISA_CMD_STORE    0x32
+
+struct IsaCmd
 {
-   int i;
-   for (i = 0; i < FLASH_DELAY; i++)       /* Wait a bit. */
-      __asm__("nop");
-}
+   uint8_t bytes[4]; //the remaining 4 bytes are always zero
+};
+
+static CanHardware* isaCan = 0;
+static IsaCmd isaQueue[ISA_QUEUE_LEN];
+static uint8_t isaHead = 0;
+static uint8_t isaTail = 0;
+static bool isaWaiting = false;
+static int isaTimer = 0;
 
 void ISA::DecodeCAN(int id, uint32_t data[2])
 {
    switch (id)
    {
+   case 0x511:
+      ISA::handle511(data);//ISA command acknowledge
+      break;
    case 0x521:
       ISA::handle521(data);//ISA CAN MESSAGE
       break;
@@ -72,6 +91,7 @@ void ISA::DecodeCAN(int id, uint32_t data[2])
 
 void ISA::RegisterCanMessages(CanHardware* can)
 {
+   can->RegisterUserMessage(0x511);//ISA command response
    can->RegisterUserMessage(0x521);//ISA MSG
    can->RegisterUserMessage(0x522);//ISA MSG
    can->RegisterUserMessage(0x523);//ISA MSG
@@ -84,154 +104,118 @@ void ISA::RegisterCanMessages(CanHardware* can)
 
 void ISA::initialize(CanHardware* can)
 {
-   uint8_t bytes[8];
-
    firstframe=false;
    STOP(can);
-   delay();
    for(int i=0; i<9; i++)
    {
-      bytes[0]=(0x20+i);
-      bytes[1]=0x42;
-      bytes[2]=0x00;
-      bytes[3]=0x64;
-      bytes[4]=0x00;
-      bytes[5]=0x00;
-      bytes[6]=0x00;
-      bytes[7]=0x00;
-
-      can->Send(0x411, (uint32_t*)bytes, 8);
-      delay();
-
-      sendSTORE(can);
-      delay();
+      //Result channels 0x20..0x28 cyclic, little endian. Current every 10ms for the coulomb counter, the rest 100ms
+      Queue(can, 0x20+i, 0x42, 0x00, i == 0 ? 0x0A : 0x64);
    }
+   sendSTORE(can);
    START(can);
-   delay();
-
 }
 
 void ISA::STOP(CanHardware* can)
 {
-   uint8_t bytes[8];
-//SEND STOP///////
-
-
-   bytes[0]=0x34;
-   bytes[1]=0x00;
-   bytes[2]=0x01;
-   bytes[3]=0x00;
-   bytes[4]=0x00;
-   bytes[5]=0x00;
-   bytes[6]=0x00;
-   bytes[7]=0x00;
-
-   can->Send(0x411, (uint32_t*)bytes,8);
-
+   Queue(can, 0x34, 0x00, 0x01, 0x00);
 }
+
 void ISA::sendSTORE(CanHardware* can)
 {
-   uint8_t bytes[8];
-//SEND STORE///////
-
-   bytes[0]=0x32;
-   bytes[1]=0x00;
-   bytes[2]=0x00;
-   bytes[3]=0x00;
-   bytes[4]=0x00;
-   bytes[5]=0x00;
-   bytes[6]=0x00;
-   bytes[7]=0x00;
-
-   can->Send(0x411, (uint32_t*)bytes,8);
+   Queue(can, ISA_CMD_STORE, 0x00, 0x00, 0x00);
 }
 
 void ISA::START(CanHardware* can)
 {
-   uint8_t bytes[8];
-//SEND START///////
-
-   bytes[0]=0x34;
-   bytes[1]=0x01;
-   bytes[2]=0x01;
-   bytes[3]=0x00;
-   bytes[4]=0x00;
-   bytes[5]=0x00;
-   bytes[6]=0x00;
-   bytes[7]=0x00;
-   can->Send(0x411, (uint32_t*)bytes,8);
-
-
+   Queue(can, 0x34, 0x01, 0x01, 0x00);
 }
 
 void ISA::RESTART(CanHardware* can)
 {
    //Has the effect of zeroing AH and KWH
-   uint8_t bytes[8];
-
-   bytes[0]=0x3F;
-   bytes[1]=0x00;
-   bytes[2]=0x00;
-   bytes[3]=0x00;
-   bytes[4]=0x00;
-   bytes[5]=0x00;
-   bytes[6]=0x00;
-   bytes[7]=0x00;
-   //Can::GetInterface(Param::GetInt(Param::shunt_can))->;
-   can->Send(0x411, (uint32_t*)bytes,8);
-
+   Queue(can, 0x3F, 0x00, 0x00, 0x00);
 }
 
-
 void ISA::deFAULT(CanHardware* can)
 {
    //Returns module to original defaults
-   uint8_t bytes[8];
-
-   bytes[0]=0x3D;
-   bytes[1]=0x00;
-   bytes[2]=0x00;
-   bytes[3]=0x00;
-   bytes[4]=0x00;
-   bytes[5]=0x00;
-   bytes[6]=0x00;
-   bytes[7]=0x00;
-   can->Send(0x411, (uint32_t*)bytes,8);
-
-
+   Queue(can, 0x3D, 0x00, 0x00, 0x00);
 }
 
-
 void ISA::initCurrent(CanHardware* can)
 {
-   uint8_t bytes[8];
    STOP(can);
-   delay();
-   bytes[0]=0x21;
-   bytes[1]=0x42;
-   bytes[2]=0x01;
-   bytes[3]=0x61;
-   bytes[4]=0x00;
-   bytes[5]=0x00;
-   bytes[6]=0x00;
-   bytes[7]=0x00;
-
-   can->Send(0x411, (uint32_t*)bytes,8);
-
-   delay();
+   //Result 0x21 (U1) cyclic, 353ms
+   Queue(can, 0x21, 0x42, 0x01, 0x61);
    sendSTORE(can);
    START(can);
-   delay();
+}
 
+/** Send the next queued command once the previous one is answered or timed out */
+void ISA::Task10Ms()
+{
+   if (isaWaiting)
+   {
+      isaTimer += 10;
+
+      if (isaTimer < (isaQueue[isaTail].bytes[0] == ISA_CMD_STORE ? ISA_STORE_MS : ISA_TIMEOUT_MS))
+         return;
+      //No answer, carry on anyway like the old blind delays did
+      isaWaiting = false;
+      isaTail = (isaTail + 1) % ISA_QUEUE_LEN;
+   }
+
+   if (isaTail != isaHead && isaCan != 0)
+   {
+      uint8_t bytes[8] = { 0 };
+
+      for (int i = 0; i < 4; i++)
+         bytes[i] = isaQueue[isaTail].bytes[i];
+
+      isaCan->Send(ISA_CMD_ID, (uint32_t*)bytes, 8);
+      isaTimer = 0;
+      isaWaiting = true;
+   }
+}
+
+bool ISA::IsBusy()
+{
+   return isaWaiting || isaTail != isaHead;
+}
+
+void ISA::Queue(CanHardware* can, uint8_t cmd, uint8_t b1, uint8_t b2, uint8_t b3)
+{
+   uint8_t next = (isaHead + 1) % ISA_QUEUE_LEN;
+
+   isaCan = can;
+   if (next == isaTail) return; //full, a sequence is already pending
+
+   isaQueue[isaHead].bytes[0] = cmd;
+   isaQueue[isaHead].bytes[1] = b1;
+   isaQueue[isaHead].bytes[2] = b2;
+   isaQueue[isaHead].bytes[3] = b3;
+   isaHead = next;
 }
 
 /********* Private functions *******/
 
+void ISA::handle511(uint32_t data[2])  //Command response
+{
+   uint8_t* bytes = (uint8_t*)data;
+
+   if (isaWaiting && (bytes[0] & 0x7F) == isaQueue[isaTail].bytes[0])
+   {
+      isaWaiting = false;
+      isaTail = (isaTail + 1) % ISA_QUEUE_LEN;
+   }
+}
+
 void ISA::handle521(uint32_t data[2])  //Amperes
 
 {
    uint8_t* bytes = (uint8_t*)data;// arrgghhh this converts the two 32bit array into bytes. See comments are useful:)
    Amperes = ((bytes[5] << 24) | (bytes[4] << 16) | (bytes[3] << 8) | (bytes[2]));
+   CoulombCounter::AddSample(Amperes, Voltage);
 }
 
 void ISA::handle522(uint32_t data[2])  //Voltage
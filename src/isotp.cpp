@@ -0,0 +1,296 @@
+/*
+ * This file is part of the RaVus BMS project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libopencm3/cm3/cortex.h>
+#include "isotp.h"
+#include "my_math.h"
+
+#define PCI_SINGLE           0x00
+#define PCI_FIRST            0x10
+#define PCI_CONSECUTIVE      0x20
+#define PCI_FLOW             0x30
+#define FC_CTS               0
+#define FC_WAIT              1
+#define FC_OVERFLOW          2
+#define ISOTP_TIMEOUT_MS     1000  // N_Bs and N_Cr
+#define ISOTP_PAD            0xFF
+
+enum IsoTpState
+{
+    TP_IDLE,
+    TP_TX_WAIT_FC,   // first frame out, waiting for the receiver to clear us
+    TP_TX_CF,        // sending consecutive frames, paced by the receiver's STmin
+    TP_RX_WAIT,      // request out, waiting for the first reply frame
+    TP_RX_CF,        // first frame in, collecting consecutive frames
+    TP_DONE,
+    TP_ERROR
+};
+
+static CanHardware* can = 0;
+static uint32_t tpTxId = 0;
+static IsoTpState tpState = TP_IDLE;
+static uint8_t  tpBuf[ISOTP_MAX_LEN];   // request while sending, reply after that
+static uint16_t tpLen = 0;
+static uint16_t tpPos = 0;
+static uint8_t  tpSn = 0;
+static uint8_t  tpBlock = 0;            // frames left in the current block, 0 = unlimited
+static uint8_t  tpBs = 0;               // block size of the other side while sending
+static uint8_t  tpStMin = 0;            // separation time of the other side while sending
+static uint8_t  rxBs = 0;               // what we ask the other side for
+static uint8_t  rxStMin = 0;
+static int      tpTimer = 0;
+static uint16_t tpFrames = 0;
+
+void IsoTp::Init(CanHardware* c, uint32_t txId, uint32_t rxId)
+{
+    can = c;
+    tpTxId = txId;
+    tpState = TP_IDLE;
+    can->RegisterUserMessage(rxId);
+}
+
+void IsoTp::SetFlowControl(uint8_t blockSize, uint8_t stMinMs)
+{
+    rxBs = blockSize;
+    rxStMin = MIN(stMinMs, 127);
+}
+
+/* HandleRx runs in the CAN receive interrupt. Everything called from the
+ * scheduler that changes the transfer state does so with interrupts off, so
+ * a reply can neither land in a half set up transfer nor get lost between
+ * sending a frame and switching to the state that expects its answer.
+ */
+
+/** Start a request, false while another one is in flight */
+bool IsoTp::Send(const uint8_t* data, uint16_t len)
+{
+    uint8_t frame[8];
+
+    if (can == 0 || len == 0 || len > ISOTP_MAX_LEN - 1)
+        return false;
+
+    cm_disable_interrupts();
+    if (tpState != TP_IDLE && tpState != TP_ERROR)
+    {
+        cm_enable_interrupts();
+        return false;
+    }
+
+    for (uint16_t i = 0; i < len; i++)
+        tpBuf[i] = data[i];
+    tpLen = len;
+    tpTimer = 0;
+
+    if (len <= 7)
+    {
+        frame[0] = PCI_SINGLE | len;
+        for (int i = 0; i < 7; i++)
+            frame[i + 1] = i < len ? data[i] : ISOTP_PAD;
+        SendFrame(frame);
+        tpState = TP_RX_WAIT;
+    }
+    else
+    {
+        frame[0] = PCI_FIRST | (len >> 8);
+        frame[1] = len & 0xFF;
+        for (int i = 0; i < 6; i++)
+            frame[i + 2] = data[i];
+        SendFrame(frame);
+        tpPos = 6;
+        tpSn = 1;
+        tpState = TP_TX_WAIT_FC;
+    }
+    cm_enable_interrupts();
+    return true;
+}
+
+void IsoTp::HandleRx(uint32_t data[2])
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint8_t pci = bytes[0] & 0xF0;
+
+    tpFrames++;
+
+    switch (tpState)
+    {
+    case TP_TX_WAIT_FC:
+        if (pci != PCI_FLOW) break;
+        tpTimer = 0;
+        if ((bytes[0] & 0x0F) == FC_CTS)
+        {
+            tpBs = bytes[1];
+            tpBlock = tpBs;
+            //0xF1..0xF9 are 100..900 us, one tick is the best we can do anyway
+            tpStMin = bytes[2] <= 127 ? bytes[2] : 1;
+            tpState = TP_TX_CF;
+        }
+        else if ((bytes[0] & 0x0F) == FC_OVERFLOW)
+        {
+            tpState = TP_ERROR;
+        }
+        break;
+    case TP_RX_WAIT:
+        tpTimer = 0;
+        if (pci == PCI_SINGLE && (bytes[0] & 0x0F) > 0 && (bytes[0] & 0x0F) <= 7)
+        {
+            tpLen = bytes[0] & 0x0F;
+            for (int i = 0; i < tpLen; i++)
+                tpBuf[i] = bytes[i + 1];
+            tpState = TP_DONE;
+        }
+        else if (pci == PCI_FIRST)
+        {
+            tpLen = ((bytes[0] & 0x0F) << 8) | bytes[1];
+            if (tpLen > ISOTP_MAX_LEN || tpLen < 8)
+            {
+                SendFlowControl(FC_OVERFLOW);
+                tpState = TP_ERROR;
+                break;
+            }
+            for (int i = 0; i < 6; i++)
+                tpBuf[i] = bytes[i + 2];
+            tpPos = 6;
+            tpSn = 1;
+            tpBlock = rxBs;
+            SendFlowControl(FC_CTS);
+            tpState = TP_RX_CF;
+        }
+        break;
+    case TP_RX_CF:
+        if (pci != PCI_CONSECUTIVE) break;
+        tpTimer = 0;
+        if ((bytes[0] & 0x0F) != tpSn)
+        {
+            tpState = TP_ERROR; //lost a frame, the caller asks again
+            break;
+        }
+        tpSn = (tpSn + 1) & 0x0F;
+        for (int i = 1; i < 8 && tpPos < tpLen; i++)
+            tpBuf[tpPos++] = bytes[i];
+
+        if (tpPos >= tpLen)
+        {
+            tpState = TP_DONE;
+        }
+        else if (rxBs != 0 && --tpBlock == 0)
+        {
+            tpBlock = rxBs;
+            SendFlowControl(FC_CTS);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void IsoTp::Tick(int ms)
+{
+    cm_disable_interrupts();
+    if (tpState == TP_IDLE || tpState == TP_DONE || tpState == TP_ERROR)
+    {
+        cm_enable_interrupts();
+        return;
+    }
+
+    tpTimer += ms;
+
+    if (tpState == TP_TX_CF)
+    {
+        if (tpTimer >= tpStMin)
+        {
+            tpTimer = 0;
+            SendConsecutive();
+        }
+    }
+    else if (tpTimer >= ISOTP_TIMEOUT_MS)
+    {
+        tpState = TP_ERROR;
+    }
+    cm_enable_interrupts();
+}
+
+void IsoTp::SendConsecutive()
+{
+    uint8_t frame[8];
+
+    frame[0] = PCI_CONSECUTIVE | tpSn;
+    for (int i = 1; i < 8; i++)
+        frame[i] = tpPos < tpLen ? tpBuf[tpPos++] : ISOTP_PAD;
+    SendFrame(frame);
+    tpSn = (tpSn + 1) & 0x0F;
+
+    if (tpPos >= tpLen)
+        tpState = TP_RX_WAIT;
+    else if (tpBs != 0 && --tpBlock == 0)
+        tpState = TP_TX_WAIT_FC;
+}
+
+void IsoTp::SendFlowControl(uint8_t flag)
+{
+    uint8_t frame[8] = { (uint8_t)(PCI_FLOW | flag), rxBs, rxStMin, ISOTP_PAD, ISOTP_PAD, ISOTP_PAD, ISOTP_PAD, ISOTP_PAD };
+
+    SendFrame(frame);
+}
+
+void IsoTp::SendFrame(const uint8_t* frame)
+{
+    uint32_t data[2];
+    uint8_t* bytes = (uint8_t*)data;
+
+    for (int i = 0; i < 8; i++)
+        bytes[i] = frame[i];
+    can->Send(tpTxId, data, 8);
+    tpFrames++;
+}
+
+IsoTp::Status IsoTp::GetStatus()
+{
+    switch (tpState)
+    {
+    case TP_IDLE: return ISOTP_IDLE;
+    case TP_DONE: return ISOTP_DONE;
+    case TP_ERROR: return ISOTP_ERROR;
+    default: return ISOTP_BUSY;
+    }
+}
+
+const uint8_t* IsoTp::GetData()
+{
+    return tpBuf;
+}
+
+uint16_t IsoTp::GetLength()
+{
+    return tpState == TP_DONE ? tpLen : 0;
+}
+
+void IsoTp::Release()
+{
+    cm_disable_interrupts();
+    tpState = TP_IDLE;
+    cm_enable_interrupts();
+}
+
+/** Frames sent and received since the last call, for bus load accounting */
+uint16_t IsoTp::TakeFrameCount()
+{
+    cm_disable_interrupts();
+    uint16_t frames = tpFrames;
+    tpFrames = 0;
+    cm_enable_interrupts();
+    return frames;
+}
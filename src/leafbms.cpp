@@ -21,13 +21,31 @@
 #include "leafbms.h"
 #include "my_fp.h"
 #include "my_math.h"
+#include "crc.h"
+#include "isotp.h"
 
 #define ZE0_BATTERY 0 //2011-2013 ZE0
 #define AZE0_BATTERY 1 //2013-2017 AZE0
 #define ZE1_BATTERY 2 //2018+ ZE1
 static uint8_t LEAF_battery_Type = ZE0_BATTERY;
+
+typedef Crc<uint8_t, 8, 0x85, CRC_NIBBLE> LeafCrc;
 static int temperature = 0;
 
+/* LBC diagnostics, request 0x21 <group> on 0x79B, reply 0x61 <group> on 0x7BB.
+ * Polls are paced so the diagnostic traffic stays under DiagLoad percent
+ * of the 500 kbit bus, about 3850 frames/s at 100%. */
+#define LBC_REQ_ID           0x79B
+#define LBC_REPLY_ID         0x7BB
+#define LBC_CELLS            96
+#define LBC_TEMPS            4
+#define FRAMES_PER_PCT       385    // milli-frames per 10 ms tick for 1% load
+#define CREDIT_MAX           10000  // at most 10 frames of burst
+
+static const uint8_t lbcGroups[] = { 0x02, 0x04, 0x06 }; //cell voltages, temperatures, balancing shunts
+static uint8_t lbcGroup = 0;
+static int32_t lbcCredit = 0;
+
 void LeafBMS::RegisterCanMessages(CanHardware* can)
 {
     can->RegisterUserMessage(0x1DB);//Leaf BMS message 10ms
@@ -38,6 +56,129 @@ void LeafBMS::RegisterCanMessages(CanHardware* can)
     //can->RegisterUserMessage(0x59E);//Leaf BMS message 500ms (Only on AZE0)
     can->RegisterUserMessage(0x1C2);//Leaf BMS message 10ms (ZE1)
     can->RegisterUserMessage(0x1ED);//Leaf BMS message 10ms (ZE1, only on 62kWh)
+    IsoTp::Init(can, LBC_REQ_ID, LBC_REPLY_ID);//LBC diagnostic replies
+}
+
+void LeafBMS::Task10Ms()
+{
+    int load = Param::GetInt(Param::DiagLoad);
+
+    IsoTp::Tick(10);
+
+    //Token bucket over the frames we put on and pull off the bus
+    lbcCredit += load * FRAMES_PER_PCT - IsoTp::TakeFrameCount() * 1000;
+    lbcCredit = MIN(lbcCredit, CREDIT_MAX);
+
+    switch (IsoTp::GetStatus())
+    {
+    case IsoTp::ISOTP_DONE:
+        DecodeGroup(IsoTp::GetData(), IsoTp::GetLength());
+        IsoTp::Release();
+        break;
+    case IsoTp::ISOTP_ERROR:
+        IsoTp::Release();
+        break;
+    case IsoTp::ISOTP_IDLE:
+        if (lbcCredit >= 0)
+        {
+            uint8_t req[2] = { 0x21, lbcGroups[lbcGroup] };
+
+            //Spread the reply frames out to the same budget, STmin in ms
+            IsoTp::SetFlowControl(0, MIN(10000 / (load * FRAMES_PER_PCT), 127));
+            if (IsoTp::Send(req, 2))
+                lbcGroup = (lbcGroup + 1) % sizeof(lbcGroups);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void LeafBMS::DecodeGroup(const uint8_t* data, uint16_t len)
+{
+    if (len < 2 || data[0] != 0x61) return; //negative response or garbage
+
+    switch (data[1])
+    {
+    case 0x02: DecodeCells(data + 2, len - 2); break;
+    case 0x04: DecodeTemps(data + 2, len - 2); break;
+    case 0x06: DecodeShunts(data + 2, len - 2); break;
+    default: break;
+    }
+}
+
+/** 96 cells, big endian mV */
+void LeafBMS::DecodeCells(const uint8_t* data, uint16_t len)
+{
+    int min = 10000, max = 0, minCell = 0, maxCell = 0, cells = 0;
+    int32_t sum = 0;
+
+    for (int i = 0; i < LBC_CELLS && i * 2 + 1 < len; i++)
+    {
+        int mv = (data[i * 2] << 8) | data[i * 2 + 1];
+
+        if (mv == 0xFFFF) continue; //cell not fitted
+        Param::SetInt((Param::PARAM_NUM)(Param::u1 + i), mv);
+        if (mv < min) { min = mv; minCell = i + 1; }
+        if (mv > max) { max = mv; maxCell = i + 1; }
+        sum += mv;
+        cells++;
+    }
+
+    if (cells == 0) return;
+    Param::SetInt(Param::umin, min);
+    Param::SetInt(Param::umax, max);
+    Param::SetInt(Param::umincell, minCell);
+    Param::SetInt(Param::umaxcell, maxCell);
+    Param::SetInt(Param::deltaV, max - min);
+    Param::SetInt(Param::uavg, sum / cells);
+    Param::SetInt(Param::CellsPresent, cells);
+}
+
+/** Per sensor: thermistor counts (2 bytes) then degC (1 byte, signed) */
+void LeafBMS::DecodeTemps(const uint8_t* data, uint16_t len)
+{
+    int min = 127, max = -128, sum = 0, sensors = 0;
+
+    for (int i = 0; i < LBC_TEMPS && i * 3 + 2 < len; i++)
+    {
+        int raw = (data[i * 3] << 8) | data[i * 3 + 1];
+        int degC = (int8_t)data[i * 3 + 2];
+
+        if (raw == 0xFFFF) continue; //ZE1 packs only fit three sensors
+        Param::SetInt((Param::PARAM_NUM)(Param::LeafT1 + i), degC);
+        min = MIN(min, degC);
+        max = MAX(max, degC);
+        sum += degC;
+        sensors++;
+    }
+
+    if (sensors == 0) return;
+    Param::SetInt(Param::TempMin, min);
+    Param::SetInt(Param::TempMax, max);
+    Param::SetInt(Param::Tempavg, sum / sensors);
+}
+
+/** One nibble per four cells, the lowest cell in bit 3. Published 24 cells per value */
+void LeafBMS::DecodeShunts(const uint8_t* data, uint16_t len)
+{
+    int32_t mask = 0;
+    int balancing = 0;
+
+    for (int i = 0; i < LBC_CELLS && i / 4 < len; i++)
+    {
+        if (data[i / 4] & (0x08 >> (i & 3)))
+        {
+            mask |= 1L << (i % 24);
+            balancing++;
+        }
+        if (i % 24 == 23)
+        {
+            Param::SetInt((Param::PARAM_NUM)(Param::LeafShunt1 + i / 24), mask);
+            mask = 0;
+        }
+    }
+    Param::SetInt(Param::CellsBalancing, balancing);
 }
 
 void LeafBMS::DecodeCAN(int id, uint32_t data[2])
@@ -50,7 +191,7 @@ void LeafBMS::DecodeCAN(int id, uint32_t data[2])
                 //Message content malformed, abort reading data from it! Raise flag!
                 break;
             }
-            float cur = uint16_t(bytes[0] << 3) + uint16_t(bytes[1] >>5);
+            int cur = uint16_t(bytes[0] << 3) + uint16_t(bytes[1] >>5);
             if(cur>1023)cur -=2047; //check if negative
             uint16_t udc = uint16_t(bytes[2] << 2) + uint16_t(bytes[3] >>6);
             //bool interlock = (bytes[3] & (1 << 3)) >> 3;
@@ -58,12 +199,11 @@ void LeafBMS::DecodeCAN(int id, uint32_t data[2])
 
             if (Param::GetInt(Param::ShuntType) == 0)//Only populate if no shunt is used
             {
-                float BattCur = cur / 2;
-                float BattVoltage = udc / 2;
-                Param::SetFloat(Param::idc, BattCur);
-                Param::SetFloat(Param::udc, BattVoltage);
-                float kw = (BattVoltage*BattCur)/1000;//get power from isa sensor and post to parameter database
-                Param::SetFloat(Param::power, kw);
+                //both in 0.5 units
+                Param::SetFixed(Param::idc, FP_FROMINT(cur) / 2);
+                Param::SetFixed(Param::udc, FP_FROMINT(udc) / 2);
+                int32_t watts = (udc * cur) / 4;//get power from isa sensor and post to parameter database
+                Param::SetFixed(Param::power, FP_FROMINT(watts) / 1000);
             }
             break;
         }
@@ -72,20 +212,21 @@ void LeafBMS::DecodeCAN(int id, uint32_t data[2])
                 //Message content malformed, abort reading data from it! Raise flag!
                 break;
             }
-            float dislimit = uint16_t(bytes[0] << 2) + uint16_t(bytes[1] >>6);
-            dislimit = dislimit*0.25; //Kw discharge limit
-			if (Param::GetInt(Param::ShuntType) == 0) dislimit = dislimit*1000 / Param::GetFloat(Param::udc);
-			dislimit = dislimit*1000 / Param::GetFloat(Param::udc1);//Transform into Amps
+            //pack voltage from the BMS itself when no shunt is fitted
+            s32fp udcLim = Param::GetInt(Param::ShuntType) == 0 ? Param::Get(Param::udc) : Param::Get(Param::udc1);
+            if (udcLim <= 0) udcLim = FP_FROMINT(1);
+
+            int32_t dislimit = uint16_t(bytes[0] << 2) + uint16_t(bytes[1] >>6);
+            dislimit = dislimit*250; //W discharge limit
+			dislimit = FP_FROMINT(dislimit) / udcLim;//Transform into Amps
 			
-            float chglimit = uint16_t((bytes[1] & 0x3F) << 4) + uint16_t(bytes[2] >>4);
-            chglimit = chglimit*0.25; //Kw charge limit
-			if (Param::GetInt(Param::ShuntType) == 0) chglimit = chglimit*1000 / Param::GetFloat(Param::udc);
-			chglimit = chglimit*1000 / Param::GetFloat(Param::udc1);//Transform into Amps
+            int32_t chglimit = uint16_t((bytes[1] & 0x3F) << 4) + uint16_t(bytes[2] >>4);
+            chglimit = chglimit*250; //W charge limit
+			chglimit = FP_FROMINT(chglimit) / udcLim;//Transform into Amps
 			
-            float chargelimit = uint16_t((bytes[2] & 0x0F) << 6) + uint16_t(bytes[3] >>2);
-            chargelimit = chargelimit*0.1; //Kw charger limit
-			if (Param::GetInt(Param::ShuntType) == 0) chargelimit = chargelimit*1000 / Param::GetFloat(Param::udc);
-			chargelimit = chargelimit*1000 / Param::GetFloat(Param::udc1);//Transform into Amps
+            int32_t chargelimit = uint16_t((bytes[2] & 0x0F) << 6) + uint16_t(bytes[3] >>2);
+            chargelimit = chargelimit*100; //W charger limit
+			chargelimit = FP_FROMINT(chargelimit) / udcLim;//Transform into Amps
             //Param::SetFixed(Param::dislim, dislimit / 4);
 
             //Param::SetFloat(Param::BMS_ChargeLim, chargelimit);
@@ -98,11 +239,10 @@ void LeafBMS::DecodeCAN(int id, uint32_t data[2])
                 //Message content malformed, abort reading data from it! Raise flag!
                 break;
             }
-            float soc = uint16_t(bytes[0] << 2) + uint16_t(bytes[1] >> 6);
+            int soc = uint16_t(bytes[0] << 2) + uint16_t(bytes[1] >> 6);
             if (Param::GetInt(Param::ShuntType) == 0)//Only populate if no shunt is used
             {
-                soc = soc*0.1;
-                Param::SetFloat(Param::SOC, soc);
+                Param::SetFixed(Param::SOC, FP_FROMINT(soc) / 10);//0.1% units
             }
 
             uint16_t IsoTemp = uint16_t(bytes[4] << 2) + uint16_t(bytes[5] >> 6);
@@ -164,6 +304,9 @@ void LeafBMS::DecodeCAN(int id, uint32_t data[2])
             LEAF_battery_Type = ZE1_BATTERY;
             break;
         }
+        case LBC_REPLY_ID:
+            IsoTp::HandleRx(data);
+            break;
         default:
             break;
     }
@@ -171,18 +314,6 @@ void LeafBMS::DecodeCAN(int id, uint32_t data[2])
 
 bool LeafBMS::isMessageCorrupt(uint8_t *data)
 {
-    uint8_t crc = 0;
-    uint8_t polynomial = 0x85;
-
-    for (int b = 0; b < 8; b++) {
-        uint8_t byte = (b == 7) ? 0 : data[b]; // Treat 8th byte as 0 during calculation.
-        for (int i = 7; i >= 0; i--) {
-            uint8_t bit = ((byte & (1 << i)) > 0) ? 1 : 0;
-            if (crc >= 0x80)
-                crc = (uint8_t)(((crc << 1) + bit) ^ polynomial);
-            else
-                crc = (uint8_t)((crc << 1) + bit);
-        }
-    }
-    return crc != data[7];
+    //CRC8 poly 0x85 over the first 7 bytes, sent in the 8th
+    return LeafCrc::Calc(data, 7) != data[7];
 }
\ No newline at end of file
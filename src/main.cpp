@@ -45,6 +45,8 @@
 #include "BMSUtil.h"
 #include "isa_shunt.h"
 #include "bmw_sbox.h"
+#include "coulomb.h"
+#include "ocvstore.h"
 #define PRINT_JSON 0
 
 
@@ -61,7 +63,6 @@ static CanSdo* canSdo;
 static uint8_t BMStype;
 int uauxGain = 222;	
 uint8_t Gcount = 0x00;
-float SOCVal = 0;
 
 //sample 10 ms task
 static void Ms10Task(void)
@@ -127,6 +128,21 @@ static void Ms10Task(void)
 		break;
 	}
 	ProcessUdc();
+
+    if(BMStype == BMS_M3)
+    {
+        BATMan::loop();
+    }
+    else if(BMStype == BMS_TESLAS)
+    {
+        TeslaBMSManager::Task10Ms();
+    }
+    else if(BMStype == BMS_LEAF)
+    {
+        LeafBMS::Task10Ms();
+    }
+
+    if (Param::GetInt(Param::ShuntType) == 1) ISA::Task10Ms();
 }
 
 	
@@ -137,7 +153,7 @@ static void Ms100Task(void)
     iwdg_reset();
 	Param::SetInt(Param::IGN, DigIo::IGN.Get());
 	Param::SetInt(Param::CHG, DigIo::CHG.Get());
-	Param::SetFloat(Param::GP1_ain, (float)AnaIn::Ain.Get());
+	Param::SetInt(Param::GP1_ain, AnaIn::Ain.Get());
 	Param::SetInt(Param::GP1_din, DigIo::DIN1.Get());
 	Param::SetInt(Param::GP2_din, DigIo::DIN2.Get());
 	if(DigIo::DIN1.Get() || (Param::GetInt(Param::opmode) == 1)) 
@@ -160,8 +176,8 @@ static void Ms100Task(void)
 		DigIo::FAN.Clear();
 		Param::SetInt(Param::CoolantFAN, 0);
 	}
-    float cpuLoad = scheduler->GetCpuLoad();
-    Param::SetFloat(Param::cpuload, cpuLoad / 10);
+    int cpuLoad = scheduler->GetCpuLoad();
+    Param::SetFixed(Param::cpuload, FP_FROMINT(cpuLoad) / 10);
 	/*
 	if(Param::GetInt(Param::ShuntType) != 0)//Do not do any SOC calcs
     {
@@ -170,12 +186,8 @@ static void Ms100Task(void)
 	*/
 	
 //!!! to change to BMS class with selectable types under it to clean up code and simplify interactions//
-    if(BMStype == BMS_M3)
-    {
-        BATMan::loop();
-    }
 	/*
-	else if(BMStype == BMS_TESLAS)
+	if(BMStype == BMS_TESLAS)
     {
         BATMan::loop();
     }
@@ -193,6 +205,7 @@ static void Ms100Task(void)
 	*/
     
 ///////////////
+    CoulombCounter::Task100Ms();
     BMSUtil::UpdateSOC();
     canMap->SendAll();
 	Can_Tasks();
@@ -206,41 +219,37 @@ static void Ms200Task(void)
 	tim3_setup();
 }
 
+//Sensor readings in thousandths to fixed point, split so large counters don't overflow the shift
+static s32fp MilliToFixed(int32_t milli)
+{
+    return FP_FROMINT(milli / 1000) + FP_FROMINT(milli % 1000) / 1000;
+}
+
 void ProcessUdc()
 {
   
     if (Param::GetInt(Param::ShuntType) == 1)//ISA shunt
     {
-        float udc1 = ((float)ISA::Voltage)/1000;//get voltage from isa sensor and post to parameter database
-        Param::SetFloat(Param::udc1, udc1);
-        float udc2 = ((float)ISA::Voltage2)/1000;//get voltage from isa sensor and post to parameter database
-        Param::SetFloat(Param::udc2, udc2);
-        float udc3 = ((float)ISA::Voltage3)/1000;//get voltage from isa sensor and post to parameter database
-        Param::SetFloat(Param::udc3, udc3);
-        float idc = ((float)ISA::Amperes)/1000;//get current from isa sensor and post to parameter database
-        Param::SetFloat(Param::idc, idc);
-        float kw = ((float)ISA::KW)/1000;//get power from isa sensor and post to parameter database
-        Param::SetFloat(Param::power, kw);
-        float kwh = ((float)ISA::KWh)/1000;//get kwh from isa sensor and post to parameter database
-        Param::SetFloat(Param::KWh, kwh);
-        float Amph = ((float)ISA::Ah)/3600;//get Ah from isa sensor and post to parameter database
-        Param::SetFloat(Param::AMPh, Amph);
+        Param::SetFixed(Param::udc1, MilliToFixed(ISA::Voltage));//get voltage from isa sensor and post to parameter database
+        Param::SetFixed(Param::udc2, MilliToFixed(ISA::Voltage2));//get voltage from isa sensor and post to parameter database
+        Param::SetFixed(Param::udc3, MilliToFixed(ISA::Voltage3));//get voltage from isa sensor and post to parameter database
+        Param::SetFixed(Param::idc, MilliToFixed(ISA::Amperes));//get current from isa sensor and post to parameter database
+        Param::SetFixed(Param::power, MilliToFixed(ISA::KW));//get power from isa sensor and post to parameter database
+        Param::SetFixed(Param::KWh, MilliToFixed(ISA::KWh));//get kwh from isa sensor and post to parameter database
+        Param::SetFixed(Param::AMPh, FP_FROMINT(ISA::Ah / 3600) + FP_FROMINT(ISA::Ah % 3600) / 3600);//get Ah from isa sensor and post to parameter database
     }
     else if (Param::GetInt(Param::ShuntType) == 2)//BMW Sbox
     {
-        float udc = ((float)SBOX::Voltage2)/1000;//get output voltage from sbox sensor and post to parameter database
-        Param::SetFloat(Param::udc1, udc);
-        float udc2 = ((float)SBOX::Voltage)/1000;//get battery voltage from sbox sensor and post to parameter database
-        Param::SetFloat(Param::udc2, udc2);
-        float udc3 = 0;//((float)ISA::Voltage3)/1000;//get voltage from isa sensor and post to parameter database
-        Param::SetFloat(Param::udc3, udc3);
-        float idc = ((float)SBOX::Amperes)/1000;//get current from sbox sensor and post to parameter database
-        Param::SetFloat(Param::idc, idc);
-        float kw = (udc*idc)/1000;//get power from isa sensor and post to parameter database
-        Param::SetFloat(Param::power, kw);
+        int32_t watts = (SBOX::Voltage2 / 100) * (SBOX::Amperes / 100) / 100;
+
+        Param::SetFixed(Param::udc1, MilliToFixed(SBOX::Voltage2));//get output voltage from sbox sensor and post to parameter database
+        Param::SetFixed(Param::udc2, MilliToFixed(SBOX::Voltage));//get battery voltage from sbox sensor and post to parameter database
+        Param::SetInt(Param::udc3, 0);//((float)ISA::Voltage3)/1000;//get voltage from isa sensor and post to parameter database
+        Param::SetFixed(Param::idc, MilliToFixed(SBOX::Amperes));//get current from sbox sensor and post to parameter database
+        Param::SetFixed(Param::power, MilliToFixed(watts));//get power from sbox sensor and post to parameter database
     }
 
-    Param::SetFloat(Param::uaux, ((float)AnaIn::Vsense.Get()) / uauxGain);
+    Param::SetFixed(Param::uaux, FP_FROMINT(AnaIn::Vsense.Get()) / uauxGain);
 }
 void Can_Tasks()
 {
@@ -310,11 +319,17 @@ void Param::Change(Param::PARAM_NUM paramNum)
 		case Param::Tim3_4_DC:
 			tim3_setup();
 			break;
+		case Param::ScanTime:
+			BATMan::SetScanTime(Param::GetInt(Param::ScanTime));
+			break;
 		case Param::bmstype:
 		case Param::ShuntType:
 		case Param::CanCtrl:
 			SetCanFilters();
 			break;
+		case Param::IsaInit:
+			if (Param::GetInt(Param::IsaInit) == 1) ISA::initialize(can);//queued, runs from the 10ms task
+			break;
     default:
         //Handle general parameter changes here. Add paramNum labels for handling specific parameters
         break;
@@ -341,9 +356,14 @@ extern "C" int main(void)
 	gpio_primary_remap(AFIO_MAPR_SWJ_CFG_JTAG_OFF_SW_ON, AFIO_MAPR_CAN1_REMAP_PORTB);//Remap CAN pins to Portb alt funcs.
     nvic_setup(); //Set up some interrupts
     parm_load(); //Load stored parameters
+    BMStype = Param::GetInt(Param::bmstype);
+    CoulombCounter::Init(); //Restore throughput counters and SOC
+    OcvStore::Init(); //Check the user OCV curves
     spi1_setup();// SPI1 for Model 3 BMB modules
+    tim4_setup();// TIM4 times the gaps between BMB commands
 	tim3_setup();
     usart1_setup();//Usart 1 for Model S / X slaves
+    BMSUtil::UartStart();//DMA transmit and receive ring for the slaves
     Stm32Scheduler s(TIM2); //We never exit main so it's ok to put it on stack
     scheduler = &s;
 
@@ -365,7 +385,7 @@ extern "C" int main(void)
     s.AddTask(Ms100Task, 100);
 	s.AddTask(Ms200Task, 200);
 	
-	if(Param::GetInt(Param::IsaInit)==1) ISA::initialize(can);//only call this once if a new sensor is fitted.
+	if(Param::GetInt(Param::IsaInit)==1) ISA::initialize(can);//only needed once if a new sensor is fitted, queued for the 10ms task
 	Param::SetInt(Param::opmode, 0);//always off at startup
 
 
@@ -373,13 +393,11 @@ extern "C" int main(void)
     {
         BATMan::BatStart();
     }
-	/*
 	else if(BMStype == BMS_TESLAS)
     {
-        //BATMan::BatStart();
-		usart_send_blocking(USART1, 'S');
+        TeslaBMSManager::Init();
     }
-	
+	/*
 	else if(BMStype == BMS_BMW)
     {
        //BATMan::BatStart();
@@ -401,6 +419,13 @@ extern "C" int main(void)
     {
         char c = 0;
         t.Run();
+        CoulombCounter::Save(); //Flash writes stay out of the interrupts
+        CanSdo::SdoFrame* ocvSdo = sdo.GetPendingUserspaceSdo();
+        if (ocvSdo)
+        {
+            OcvStore::HandleSdo(ocvSdo); //OCV curve upload, may write flash too
+            sdo.SendSdoReply(ocvSdo);
+        }
         if (sdo.GetPrintRequest() == PRINT_JSON)
         {
             TerminalCommands::PrintParamsJson(&sdo, &c);
@@ -0,0 +1,310 @@
+/*
+ * This file is part of the RaVus BMS project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <libopencm3/cm3/cortex.h>
+#include <libopencm3/stm32/flash.h>
+#include <libopencm3/stm32/desig.h>
+#include <libopencm3/stm32/crc.h>
+#include "ocvstore.h"
+#include "params.h"
+#include "hwdefs.h"
+#include "my_math.h"
+
+#define OCV_MAGIC            0x4F435631 // "OCV1"
+#define SDO_INDEX_OCV_START  0x4010
+#define SDO_INDEX_OCV_POINT  0x4011
+#define SDO_INDEX_OCV_DUDT   0x4012
+#define SDO_INDEX_OCV_STORE  0x4013
+#define SDO_INDEX_OCV_INFO   0x4014
+#define OCV_ERASE_ALL        0xFF
+
+struct OcvCurve
+{
+    int8_t tMin;        // °C, valid from here up to the next warmer curve
+    uint8_t points;     // 0 = empty slot
+    uint16_t padding;
+    SocEkf::OcvPoint pt[OCV_MAX_POINTS];
+};
+
+struct OcvPage
+{
+    uint32_t magic;
+    OcvCurve curve[OCV_SLOTS];
+    uint32_t crc;
+};
+
+#define OCV_PAGE_WORDS       (sizeof(OcvPage) / 4)
+
+//Typical LFP cell at 25°C, flat between 30 and 90%
+static const SocEkf::OcvPoint lfpOcv[] =
+{
+    {       0, 2800, -300 },
+    {   50000, 3150, -200 },
+    {  100000, 3200, -100 },
+    {  200000, 3250,  -50 },
+    {  300000, 3275,  -30 },
+    {  400000, 3290,  -20 },
+    {  500000, 3300,  -10 },
+    {  600000, 3310,    0 },
+    {  700000, 3320,   10 },
+    {  800000, 3330,   10 },
+    {  900000, 3340,    0 },
+    {  950000, 3360,  -20 },
+    { 1000000, 3550,  -50 },
+};
+
+static_assert(sizeof(OcvPage) <= FLASH_PAGE_SIZE, "OCV curves must fit one flash page");
+
+static OcvPage page;            // RAM copy of the flash page while storing
+static OcvCurve staged;
+//GetCurve() runs in the scheduler and reads the page while these say so
+static volatile bool userValid = false;
+static volatile uint8_t slotValid = 0;   // bit per slot, checked once per page write
+
+static uint32_t GetFlashAddress()
+{
+    return FLASH_BASE + desig_get_flash_size() * 1024 - OCV_BLKNUM * FLASH_PAGE_SIZE;
+}
+
+static const OcvPage* FlashPage()
+{
+    return (const OcvPage*)GetFlashAddress();
+}
+
+static uint32_t PageCrc(const OcvPage* p)
+{
+    crc_reset();
+    return crc_calculate_block((uint32_t*)p, OCV_PAGE_WORDS - 1);
+}
+
+static bool IsValid(const OcvCurve* c)
+{
+    if (c->points < 2 || c->points > OCV_MAX_POINTS) return false;
+
+    for (int i = 1; i < c->points; i++)
+    {
+        if (c->pt[i].soc <= c->pt[i - 1].soc || c->pt[i].mv < c->pt[i - 1].mv)
+            return false;
+    }
+    return true;
+}
+
+/** Segment i..i+1 of a table sorted by voltage that holds uv, binary search */
+static int FindVoltage(const SocEkf::OcvPoint* t, int points, int32_t uv)
+{
+    int lo = 0, hi = points - 2;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+
+        if (t[mid].mv * 1000 <= uv)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+void OcvStore::Init()
+{
+    const OcvPage* p = FlashPage();
+
+    //We disable interrupts to prevent concurrent access of the CRC unit
+    cm_disable_interrupts();
+    userValid = p->magic == OCV_MAGIC && PageCrc(p) == p->crc;
+    cm_enable_interrupts();
+
+    int count = 0;
+
+    slotValid = 0;
+    for (int i = 0; i < OCV_SLOTS && userValid; i++)
+    {
+        if (IsValid(&p->curve[i]))
+        {
+            slotValid |= 1 << i;
+            count++;
+        }
+    }
+    Param::SetInt(Param::OcvCurves, count);
+}
+
+/** Curve for the selected chemistry, user curves by temperature band */
+const SocEkf::OcvPoint* OcvStore::GetCurve(int tempC, int* points)
+{
+    if (Param::GetInt(Param::Chemistry) == CHEM_USER && slotValid != 0)
+    {
+        const OcvPage* p = FlashPage();
+        const OcvCurve* best = 0;
+        const OcvCurve* coldest = 0;
+
+        for (int i = 0; i < OCV_SLOTS; i++)
+        {
+            const OcvCurve* c = &p->curve[i];
+
+            if (!(slotValid & (1 << i))) continue;
+            if (c->tMin <= tempC && (best == 0 || c->tMin > best->tMin)) best = c;
+            if (coldest == 0 || c->tMin < coldest->tMin) coldest = c;
+        }
+        best = best != 0 ? best : coldest;
+
+        if (best != 0)
+        {
+            *points = best->points;
+            return best->pt;
+        }
+    }
+
+    if (Param::GetInt(Param::Chemistry) == CHEM_LFP)
+    {
+        *points = sizeof(lfpOcv) / sizeof(lfpOcv[0]);
+        return lfpOcv;
+    }
+    *points = SocEkf::defaultOcvPoints;
+    return SocEkf::defaultOcv;
+}
+
+/** SOC in ppm for a resting cell voltage, the reverse lookup of the same curve */
+int32_t OcvStore::SocFromVoltage(int mv, int tempC)
+{
+    int points;
+    const SocEkf::OcvPoint* t = GetCurve(tempC, &points);
+    int32_t uv = mv * 1000;
+    int i = FindVoltage(t, points, uv);
+
+    //Take the entropic term off using the first guess' segment, then look again
+    uv -= t[i].dudt * (tempC - 25);
+    t += FindVoltage(t, points, uv);
+
+    int32_t dUv = (t[1].mv - t[0].mv) * 1000;
+    int32_t pos = MAX(0, MIN(dUv, uv - t[0].mv * 1000));
+
+    if (dUv == 0) return t[0].soc;
+    return t[0].soc + (int32_t)((int64_t)(t[1].soc - t[0].soc) * pos / dUv);
+}
+
+void OcvStore::HandleSdo(CanSdo::SdoFrame* sdo)
+{
+    bool write = (sdo->cmd & 0xE0) == SDO_REQUEST_DOWNLOAD;
+    bool read = sdo->cmd == SDO_READ;
+    uint8_t sub = sdo->subIndex;
+    uint32_t result = 0;
+
+    if (!read && !write)
+    {
+        sdo->cmd = SDO_ABORT;
+        sdo->data = SDO_ERR_GENERAL; //expedited transfers only
+        return;
+    }
+
+    switch (sdo->index)
+    {
+    case SDO_INDEX_OCV_START:
+        if (write && sub == 0 && ((sdo->data >> 8) & 0xFF) <= OCV_MAX_POINTS)
+        {
+            staged.tMin = (int8_t)(sdo->data & 0xFF);
+            staged.points = (sdo->data >> 8) & 0xFF;
+            staged.padding = 0;
+        }
+        else if (write && sub == 1 && sdo->data < OCV_SLOTS && userValid)
+            staged = FlashPage()->curve[sdo->data];
+        else
+            result = SDO_ERR_RANGE;
+        break;
+    case SDO_INDEX_OCV_POINT:
+        if (sub >= staged.points || (write && (sdo->data & 0xFFFF) > 10000))
+            result = SDO_ERR_RANGE;
+        else if (write)
+        {
+            staged.pt[sub].soc = (sdo->data & 0xFFFF) * 100; //0.01% to ppm
+            staged.pt[sub].mv = sdo->data >> 16;
+        }
+        else if (read)
+            sdo->data = (staged.pt[sub].soc / 100) | ((uint32_t)staged.pt[sub].mv << 16);
+        break;
+    case SDO_INDEX_OCV_DUDT:
+        if (sub >= staged.points)
+            result = SDO_ERR_RANGE;
+        else if (write)
+            staged.pt[sub].dudt = (int16_t)sdo->data;
+        else if (read)
+            sdo->data = (int32_t)staged.pt[sub].dudt;
+        break;
+    case SDO_INDEX_OCV_STORE:
+        if (!write || (sub >= OCV_SLOTS && sub != OCV_ERASE_ALL) || (sub != OCV_ERASE_ALL && !IsValid(&staged)))
+            result = SDO_ERR_RANGE;
+        else if (!StoreSlot(sub))
+            result = SDO_ERR_GENERAL;
+        break;
+    case SDO_INDEX_OCV_INFO:
+        if (!read || sub >= OCV_SLOTS || !userValid)
+            result = SDO_ERR_RANGE;
+        else
+            sdo->data = (uint8_t)FlashPage()->curve[sub].tMin | (FlashPage()->curve[sub].points << 8);
+        break;
+    default:
+        result = SDO_ERR_INVIDX;
+        break;
+    }
+
+    if (result != 0)
+    {
+        sdo->cmd = SDO_ABORT;
+        sdo->data = result;
+    }
+    else
+    {
+        sdo->cmd = write ? SDO_WRITE_REPLY : SDO_READ_REPLY;
+    }
+}
+
+/** Put the staged curve into a slot (or clear all) and rewrite the page. Main loop only */
+bool OcvStore::StoreSlot(int slot)
+{
+    uint32_t address = GetFlashAddress();
+
+    if (userValid)
+        page = *FlashPage();
+    else
+        page.magic = 0;
+
+    if (page.magic != OCV_MAGIC || slot == OCV_ERASE_ALL)
+    {
+        for (int i = 0; i < OCV_SLOTS; i++)
+            page.curve[i].points = 0;
+        page.magic = OCV_MAGIC;
+    }
+    if (slot != OCV_ERASE_ALL)
+        page.curve[slot] = staged;
+
+    cm_disable_interrupts();
+    page.crc = PageCrc(&page);
+    cm_enable_interrupts();
+
+    //Built in curves until the page is complete again
+    userValid = false;
+    slotValid = 0;
+
+    flash_unlock();
+    flash_erase_page(address);
+    for (uint32_t i = 0; i < OCV_PAGE_WORDS; i++)
+        flash_program_word(address + i * 4, ((uint32_t*)&page)[i]);
+    flash_lock();
+
+    Init();
+    return userValid;
+}
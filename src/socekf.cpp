@@ -0,0 +1,158 @@
+/*
+ * This file is part of the RaVus BMS project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "socekf.h"
+
+#define SOC_FULL      1000000
+#define SOC_STD_MAX   250000        // 25%, keeps every product below 2^63
+#define SLOPE_MAX     (10 << 16)    // 10 uV/ppm, steeper than any real cell
+#define R_MEAS_MIN    2000          // 2 mV, see SOC_STD_MAX
+#define Y_MAX         1000000       // 1 V innovation, something is badly wrong beyond that
+#define CLAMP(x, lo, hi) ((x) < (lo) ? (lo) : (x) > (hi) ? (hi) : (x))
+
+//Generic NMC cell, same points the voltage table in BMSUtil used
+const SocEkf::OcvPoint SocEkf::defaultOcv[] =
+{
+    {       0, 3300, -400 },
+    {  100000, 3400, -300 },
+    {  200000, 3450, -200 },
+    {  300000, 3500, -150 },
+    {  400000, 3560, -100 },
+    {  500000, 3600,  -50 },
+    {  600000, 3700,    0 },
+    {  700000, 3800,   50 },
+    {  800000, 4000,   50 },
+    {  900000, 4100,    0 },
+    { 1000000, 4200,  -50 },
+};
+const int SocEkf::defaultOcvPoints = sizeof(defaultOcv) / sizeof(defaultOcv[0]);
+
+/** exp(-dt/tau) in Q16 as (1 - x/256)^256, 8 squarings in Q30 */
+static int32_t Decay(int32_t dt, int32_t tau)
+{
+    int64_t x = ((int64_t)dt << 16) / (tau > 0 ? tau : 1); //Q16
+    int64_t base = (1LL << 30) - (x << 6);                 //1 - x/256 in Q30
+
+    if (base <= 0) return 0;
+    for (int i = 0; i < 8; i++)
+        base = (base * base) >> 30;
+    return base >> 14;
+}
+
+void SocEkf::Init(const Model& m, int32_t s, int32_t socStd)
+{
+    soc = CLAMP(s, 0, SOC_FULL);
+    vrc = 0;
+    socStd = CLAMP(socStd, 0, SOC_STD_MAX);
+    p11 = (int64_t)socStd * socStd;
+    p12 = 0;
+    p22 = (int64_t)m.rMeas * m.rMeas;
+    innovation = 0;
+    decayDt = 0;
+    decayTau = 0;
+    SetModel(m);
+}
+
+void SocEkf::SetModel(const Model& m)
+{
+    model = m;
+    model.rMeas = model.rMeas < R_MEAS_MIN ? R_MEAS_MIN : model.rMeas;
+}
+
+/** Time update, dSoc is the counted charge since the last call */
+void SocEkf::Predict(int32_t dSoc, int32_t milliAmps, int32_t dtMs)
+{
+    if (dtMs != decayDt || model.tau != decayTau)
+    {
+        decay = Decay(dtMs, model.tau);
+        decayDt = dtMs;
+        decayTau = model.tau;
+    }
+
+    soc = CLAMP(soc + dSoc, 0, SOC_FULL);
+    //mA * uOhm = nV
+    vrc = ((int64_t)decay * vrc + (int64_t)(65536 - decay) * ((int64_t)milliAmps * model.r1 / 1000)) >> 16;
+
+    //P = F P F' + Q with F = [1 0; 0 a]
+    p11 += (int64_t)model.qSoc * model.qSoc;
+    p11 = p11 > (int64_t)SOC_STD_MAX * SOC_STD_MAX ? (int64_t)SOC_STD_MAX * SOC_STD_MAX : p11;
+    p12 = (p12 * decay) >> 16;
+    p22 = ((((p22 * decay) >> 16) * decay) >> 16) + (int64_t)model.qRc * model.qRc;
+}
+
+/** Measurement update with the cell voltage under load */
+void SocEkf::Update(int32_t cellMv, int32_t milliAmps, int tempC)
+{
+    int32_t h;
+    int32_t ocv = Ocv(soc, tempC, &h);
+    int32_t predicted = ocv + vrc + (int32_t)((int64_t)milliAmps * model.r0 / 1000);
+    int32_t y = CLAMP(cellMv * 1000 - predicted, -Y_MAX, Y_MAX);
+
+    //H = [h 1], PH' and S = H P H' + R
+    int64_t ph1 = ((p11 * h) >> 16) + p12;
+    int64_t ph2 = ((p12 * h) >> 16) + p22;
+    int64_t s = ((ph1 * h) >> 16) + ph2 + (int64_t)model.rMeas * model.rMeas;
+
+    if (s <= 0) return; //only after overflow, don't make it worse
+
+    int64_t k1 = (ph1 << 16) / s;
+    int64_t k2 = (ph2 << 16) / s;
+
+    soc = CLAMP(soc + (int32_t)((k1 * y) >> 16), 0, SOC_FULL);
+    vrc = CLAMP(vrc + (int32_t)((k2 * y) >> 16), -Y_MAX, Y_MAX);
+
+    //P = P - K H P = P - K (PH')'
+    p11 -= (k1 * ph1) >> 16;
+    p12 -= (k1 * ph2) >> 16;
+    p22 -= (k2 * ph2) >> 16;
+    p11 = p11 < 1 ? 1 : p11;
+    p22 = p22 < 1 ? 1 : p22;
+
+    innovation = y;
+}
+
+/** Segment i..i+1 of a table sorted by SOC that holds s, binary search */
+int SocEkf::FindSegment(const OcvPoint* t, int points, int32_t s)
+{
+    int lo = 0, hi = points - 2;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+
+        if (t[mid].soc <= s)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/** OCV in uV at the given SOC and temperature, slope dOCV/dSOC in Q16 uV/ppm */
+int32_t SocEkf::Ocv(int32_t s, int tempC, int32_t* slope) const
+{
+    const OcvPoint* t = model.ocv + FindSegment(model.ocv, model.ocvPoints, s);
+    int32_t dSoc = t[1].soc - t[0].soc;
+    int32_t dMv = (t[1].mv - t[0].mv) * 1000;
+    int32_t frac = (int32_t)(((int64_t)CLAMP(s - t[0].soc, 0, dSoc) << 16) / dSoc); //Q16
+    int32_t mv = t[0].mv * 1000 + (int32_t)(((int64_t)dMv * frac) >> 16);
+    int32_t dudt = t[0].dudt + (int32_t)(((int64_t)(t[1].dudt - t[0].dudt) * frac) >> 16);
+    int64_t h = ((int64_t)dMv << 16) / dSoc;
+
+    *slope = (int32_t)CLAMP(h, 0, SLOPE_MAX);
+    return mv + dudt * (tempC - 25);
+}
@@ -0,0 +1,317 @@
+/*
+ * This file is part of the RaVus BMS project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*  Host check of include/crc.h, built and run with "make crctest".
+ *
+ *  Every Crc<> the drivers use is compared with the tables and bitwise
+ *  routines it replaced, copied from the tree before the port: single
+ *  bytes against the old tables, then random frames of every length up
+ *  to 64 bytes with random seeds, and the BATMan bit tail for 0..8 bits.
+ *  BmbPec is checked against BATMan config blocks as the old firmware put
+ *  them on the wire, against read blocks built with the old routines, and
+ *  must reject every single bit error in them.
+ *  Exits non-zero and prints the first mismatch of each kind.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "crc.h"
+#include "bmbpec.h"
+
+typedef Crc<uint8_t, 8, 0x2F> CmdCrc;
+typedef Crc<uint16_t, 14, 0x025B> DataCrc;
+typedef Crc<uint8_t, 8, 0x07> TeslaCrc;
+typedef Crc<uint8_t, 8, 0x85, CRC_NIBBLE> LeafCrc;
+typedef Crc<uint8_t, 8, 0x31, CRC_NIBBLE, true> BmwCrc;
+
+//BATMan command PEC, poly 0x2F
+static const uint8_t crcTable2f[256] =
+{
+    0x00, 0x2F, 0x5E, 0x71, 0xBC, 0x93, 0xE2, 0xCD, 0x57, 0x78, 0x09, 0x26, 0xEB, 0xC4, 0xB5, 0x9A,
+    0xAE, 0x81, 0xF0, 0xDF, 0x12, 0x3D, 0x4C, 0x63, 0xF9, 0xD6, 0xA7, 0x88, 0x45, 0x6A, 0x1B, 0x34,
+    0x73, 0x5C, 0x2D, 0x02, 0xCF, 0xE0, 0x91, 0xBE, 0x24, 0x0B, 0x7A, 0x55, 0x98, 0xB7, 0xC6, 0xE9,
+    0xDD, 0xF2, 0x83, 0xAC, 0x61, 0x4E, 0x3F, 0x10, 0x8A, 0xA5, 0xD4, 0xFB, 0x36, 0x19, 0x68, 0x47,
+    0xE6, 0xC9, 0xB8, 0x97, 0x5A, 0x75, 0x04, 0x2B, 0xB1, 0x9E, 0xEF, 0xC0, 0x0D, 0x22, 0x53, 0x7C,
+    0x48, 0x67, 0x16, 0x39, 0xF4, 0xDB, 0xAA, 0x85, 0x1F, 0x30, 0x41, 0x6E, 0xA3, 0x8C, 0xFD, 0xD2,
+    0x95, 0xBA, 0xCB, 0xE4, 0x29, 0x06, 0x77, 0x58, 0xC2, 0xED, 0x9C, 0xB3, 0x7E, 0x51, 0x20, 0x0F,
+    0x3B, 0x14, 0x65, 0x4A, 0x87, 0xA8, 0xD9, 0xF6, 0x6C, 0x43, 0x32, 0x1D, 0xD0, 0xFF, 0x8E, 0xA1,
+    0xE3, 0xCC, 0xBD, 0x92, 0x5F, 0x70, 0x01, 0x2E, 0xB4, 0x9B, 0xEA, 0xC5, 0x08, 0x27, 0x56, 0x79,
+    0x4D, 0x62, 0x13, 0x3C, 0xF1, 0xDE, 0xAF, 0x80, 0x1A, 0x35, 0x44, 0x6B, 0xA6, 0x89, 0xF8, 0xD7,
+    0x90, 0xBF, 0xCE, 0xE1, 0x2C, 0x03, 0x72, 0x5D, 0xC7, 0xE8, 0x99, 0xB6, 0x7B, 0x54, 0x25, 0x0A,
+    0x3E, 0x11, 0x60, 0x4F, 0x82, 0xAD, 0xDC, 0xF3, 0x69, 0x46, 0x37, 0x18, 0xD5, 0xFA, 0x8B, 0xA4,
+    0x05, 0x2A, 0x5B, 0x74, 0xB9, 0x96, 0xE7, 0xC8, 0x52, 0x7D, 0x0C, 0x23, 0xEE, 0xC1, 0xB0, 0x9F,
+    0xAB, 0x84, 0xF5, 0xDA, 0x17, 0x38, 0x49, 0x66, 0xFC, 0xD3, 0xA2, 0x8D, 0x40, 0x6F, 0x1E, 0x31,
+    0x76, 0x59, 0x28, 0x07, 0xCA, 0xE5, 0x94, 0xBB, 0x21, 0x0E, 0x7F, 0x50, 0x9D, 0xB2, 0xC3, 0xEC,
+    0xD8, 0xF7, 0x86, 0xA9, 0x64, 0x4B, 0x3A, 0x15, 0x8F, 0xA0, 0xD1, 0xFE, 0x33, 0x1C, 0x6D, 0x42
+};
+
+//BATMan data PEC, poly 0x025B
+static const uint16_t crc14table[256] =
+{
+    0x0000, 0x025b, 0x04b6, 0x06ed, 0x096c, 0x0b37, 0x0dda, 0x0f81,
+    0x12d8, 0x1083, 0x166e, 0x1435, 0x1bb4, 0x19ef, 0x1f02, 0x1d59,
+    0x25b0, 0x27eb, 0x2106, 0x235d, 0x2cdc, 0x2e87, 0x286a, 0x2a31,
+    0x3768, 0x3533, 0x33de, 0x3185, 0x3e04, 0x3c5f, 0x3ab2, 0x38e9,
+    0x093b, 0x0b60, 0x0d8d, 0x0fd6, 0x0057, 0x020c, 0x04e1, 0x06ba,
+    0x1be3, 0x19b8, 0x1f55, 0x1d0e, 0x128f, 0x10d4, 0x1639, 0x1462,
+    0x2c8b, 0x2ed0, 0x283d, 0x2a66, 0x25e7, 0x27bc, 0x2151, 0x230a,
+    0x3e53, 0x3c08, 0x3ae5, 0x38be, 0x373f, 0x3564, 0x3389, 0x31d2,
+    0x1276, 0x102d, 0x16c0, 0x149b, 0x1b1a, 0x1941, 0x1fac, 0x1df7,
+    0x00ae, 0x02f5, 0x0418, 0x0643, 0x09c2, 0x0b99, 0x0d74, 0x0f2f,
+    0x37c6, 0x359d, 0x3370, 0x312b, 0x3eaa, 0x3cf1, 0x3a1c, 0x3847,
+    0x251e, 0x2745, 0x21a8, 0x23f3, 0x2c72, 0x2e29, 0x28c4, 0x2a9f,
+    0x1b4d, 0x1916, 0x1ffb, 0x1da0, 0x1221, 0x107a, 0x1697, 0x14cc,
+    0x0995, 0x0bce, 0x0d23, 0x0f78, 0x00f9, 0x02a2, 0x044f, 0x0614,
+    0x3efd, 0x3ca6, 0x3a4b, 0x3810, 0x3791, 0x35ca, 0x3327, 0x317c,
+    0x2c25, 0x2e7e, 0x2893, 0x2ac8, 0x2549, 0x2712, 0x21ff, 0x23a4,
+    0x24ec, 0x26b7, 0x205a, 0x2201, 0x2d80, 0x2fdb, 0x2936, 0x2b6d,
+    0x3634, 0x346f, 0x3282, 0x30d9, 0x3f58, 0x3d03, 0x3bee, 0x39b5,
+    0x015c, 0x0307, 0x05ea, 0x07b1, 0x0830, 0x0a6b, 0x0c86, 0x0edd,
+    0x1384, 0x11df, 0x1732, 0x1569, 0x1ae8, 0x18b3, 0x1e5e, 0x1c05,
+    0x2dd7, 0x2f8c, 0x2961, 0x2b3a, 0x24bb, 0x26e0, 0x200d, 0x2256,
+    0x3f0f, 0x3d54, 0x3bb9, 0x39e2, 0x3663, 0x3438, 0x32d5, 0x308e,
+    0x0867, 0x0a3c, 0x0cd1, 0x0e8a, 0x010b, 0x0350, 0x05bd, 0x07e6,
+    0x1abf, 0x18e4, 0x1e09, 0x1c52, 0x13d3, 0x1188, 0x1765, 0x153e,
+    0x369a, 0x34c1, 0x322c, 0x3077, 0x3ff6, 0x3dad, 0x3b40, 0x391b,
+    0x2442, 0x2619, 0x20f4, 0x22af, 0x2d2e, 0x2f75, 0x2998, 0x2bc3,
+    0x132a, 0x1171, 0x179c, 0x15c7, 0x1a46, 0x181d, 0x1ef0, 0x1cab,
+    0x01f2, 0x03a9, 0x0544, 0x071f, 0x089e, 0x0ac5, 0x0c28, 0x0e73,
+    0x3fa1, 0x3dfa, 0x3b17, 0x394c, 0x36cd, 0x3496, 0x327b, 0x3020,
+    0x2d79, 0x2f22, 0x29cf, 0x2b94, 0x2415, 0x264e, 0x20a3, 0x22f8,
+    0x1a11, 0x184a, 0x1ea7, 0x1cfc, 0x137d, 0x1126, 0x17cb, 0x1590,
+    0x08c9, 0x0a92, 0x0c7f, 0x0e24, 0x01a5, 0x03fe, 0x0513, 0x0748
+};
+
+//BMW (Maxim crc poly 0x31) reflected
+static const uint8_t crc_array[256] =
+{
+    0x00, 0x5e, 0xbc, 0xe2, 0x61, 0x3f, 0xdd, 0x83,
+    0xc2, 0x9c, 0x7e, 0x20, 0xa3, 0xfd, 0x1f, 0x41,
+    0x9d, 0xc3, 0x21, 0x7f, 0xfc, 0xa2, 0x40, 0x1e,
+    0x5f, 0x01, 0xe3, 0xbd, 0x3e, 0x60, 0x82, 0xdc,
+    0x23, 0x7d, 0x9f, 0xc1, 0x42, 0x1c, 0xfe, 0xa0,
+    0xe1, 0xbf, 0x5d, 0x03, 0x80, 0xde, 0x3c, 0x62,
+    0xbe, 0xe0, 0x02, 0x5c, 0xdf, 0x81, 0x63, 0x3d,
+    0x7c, 0x22, 0xc0, 0x9e, 0x1d, 0x43, 0xa1, 0xff,
+    0x46, 0x18, 0xfa, 0xa4, 0x27, 0x79, 0x9b, 0xc5,
+    0x84, 0xda, 0x38, 0x66, 0xe5, 0xbb, 0x59, 0x07,
+    0xdb, 0x85, 0x67, 0x39, 0xba, 0xe4, 0x06, 0x58,
+    0x19, 0x47, 0xa5, 0xfb, 0x78, 0x26, 0xc4, 0x9a,
+    0x65, 0x3b, 0xd9, 0x87, 0x04, 0x5a, 0xb8, 0xe6,
+    0xa7, 0xf9, 0x1b, 0x45, 0xc6, 0x98, 0x7a, 0x24,
+    0xf8, 0xa6, 0x44, 0x1a, 0x99, 0xc7, 0x25, 0x7b,
+    0x3a, 0x64, 0x86, 0xd8, 0x5b, 0x05, 0xe7, 0xb9,
+    0x8c, 0xd2, 0x30, 0x6e, 0xed, 0xb3, 0x51, 0x0f,
+    0x4e, 0x10, 0xf2, 0xac, 0x2f, 0x71, 0x93, 0xcd,
+    0x11, 0x4f, 0xad, 0xf3, 0x70, 0x2e, 0xcc, 0x92,
+    0xd3, 0x8d, 0x6f, 0x31, 0xb2, 0xec, 0x0e, 0x50,
+    0xaf, 0xf1, 0x13, 0x4d, 0xce, 0x90, 0x72, 0x2c,
+    0x6d, 0x33, 0xd1, 0x8f, 0x0c, 0x52, 0xb0, 0xee,
+    0x32, 0x6c, 0x8e, 0xd0, 0x53, 0x0d, 0xef, 0xb1,
+    0xf0, 0xae, 0x4c, 0x12, 0x91, 0xcf, 0x2d, 0x73,
+    0xca, 0x94, 0x76, 0x28, 0xab, 0xf5, 0x17, 0x49,
+    0x08, 0x56, 0xb4, 0xea, 0x69, 0x37, 0xd5, 0x8b,
+    0x57, 0x09, 0xeb, 0xb5, 0x36, 0x68, 0x8a, 0xd4,
+    0x95, 0xcb, 0x29, 0x77, 0xf4, 0xaa, 0x48, 0x16,
+    0xe9, 0xb7, 0x55, 0x0b, 0x88, 0xd6, 0x34, 0x6a,
+    0x2b, 0x75, 0x97, 0xc9, 0x4a, 0x14, 0xf6, 0xa8,
+    0x74, 0x2a, 0xc8, 0x96, 0x15, 0x4b, 0xa9, 0xf7,
+    0xb6, 0xe8, 0x0a, 0x54, 0xd7, 0x89, 0x6b, 0x35,
+};
+
+static const uint8_t utilTopN[9] = { 0x00, 0x80, 0xc0, 0xe0, 0xf0, 0xf8, 0xfc, 0xfe, 0xff };
+
+static uint8_t calcCRC(const uint8_t* inData, uint8_t Length, uint8_t CRC8)
+{
+    for (uint8_t i = 0; i < Length; i++)
+        CRC8 = crcTable2f[CRC8 ^ inData[i]];
+    return CRC8;
+}
+
+static void crc14_bytes(uint8_t len_B, const uint8_t* bytes, uint16_t* crcP)
+{
+    for (uint8_t idx = 0; idx < len_B; idx++)
+    {
+        uint8_t pos = (uint8_t)((*crcP >> 6) ^ bytes[idx]);
+        *crcP = (uint16_t)((0x3fff & (*crcP << 8)) ^ (uint16_t)(crc14table[pos]));
+    }
+}
+
+static void crc14_bits(uint8_t len_b, uint8_t inB, uint16_t* crcP)
+{
+    inB = inB & utilTopN[len_b];
+    *crcP ^= (uint16_t)((inB) << 6);
+
+    while (len_b--)
+    {
+        if ((*crcP & 0x2000) != 0)
+            *crcP = (uint16_t)((*crcP << 1) ^ 0x025b);
+        else
+            *crcP = (uint16_t)(*crcP << 1);
+    }
+    *crcP &= 0x3fff;
+}
+
+static uint8_t GenCRC(const uint8_t* input, int lenInput)
+{
+    uint8_t crc = 0;
+    for (int x = 0; x < lenInput; x++)
+    {
+        crc ^= input[x];
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (crc << 1);
+    }
+    return crc;
+}
+
+static uint8_t BMW_crc8(const uint8_t* data, uint16_t size)
+{
+    uint8_t crc = 0;
+    for (uint16_t i = 0; i < size; ++i)
+        crc = crc_array[data[i] ^ crc];
+    return crc;
+}
+
+//LeafBMS::isMessageCorrupt without the compare, len bytes plus a zero byte shifted in bitwise
+static uint8_t LeafBitwise(const uint8_t* data, int len)
+{
+    uint8_t crc = 0;
+
+    for (int b = 0; b <= len; b++)
+    {
+        uint8_t byte = (b == len) ? 0 : data[b];
+        for (int i = 7; i >= 0; i--)
+        {
+            uint8_t bit = ((byte & (1 << i)) > 0) ? 1 : 0;
+            if (crc >= 0x80)
+                crc = (uint8_t)(((crc << 1) + bit) ^ 0x85);
+            else
+                crc = (uint8_t)((crc << 1) + bit);
+        }
+    }
+    return crc;
+}
+
+//Config write blocks of the pre-port WriteCfg: 0xF3 0x00, balance bytes, PEC word
+static const uint8_t cfgBlocks[][6] =
+{
+    { 0xF3, 0x00, 0x00, 0x00, 0x38, 0xDC },
+    { 0xF3, 0x00, 0x0A, 0xA0, 0x2E, 0x22 },
+};
+
+static uint32_t seed = 12345;
+
+static uint8_t Random()
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+static int failures = 0;
+
+static void Check(const char* name, int len, uint32_t expected, uint32_t actual)
+{
+    static const char* lastFailed = 0;
+
+    if (expected == actual) return;
+    if (name != lastFailed)
+        printf("%s: length %d expected 0x%04x got 0x%04x\n", name, len, (unsigned)expected, (unsigned)actual);
+    lastFailed = name;
+    failures++;
+}
+
+//The block must pass as is and fail with any one bit flipped
+static void CheckBlock(const char* name, uint8_t* block, int len)
+{
+    Check(name, len, true, BmbPec::Check(block, len));
+
+    //the two data bits in the PEC word are covered as well
+    for (int bit = 0; bit < len * 8; bit++)
+    {
+        block[bit / 8] ^= 0x80 >> (bit % 8);
+        Check(name, len, false, BmbPec::Check(block, len));
+        block[bit / 8] ^= 0x80 >> (bit % 8);
+    }
+}
+
+int main()
+{
+    uint8_t buf[64];
+
+    for (int b = 0; b < 256; b++)
+    {
+        uint8_t byte = b;
+
+        Check("CmdCrc table", 1, crcTable2f[b], CmdCrc::Calc(&byte, 1));
+        Check("DataCrc table", 1, crc14table[b], DataCrc::Calc(&byte, 1));
+        Check("BmwCrc table", 1, crc_array[b], BmwCrc::Calc(&byte, 1));
+    }
+
+    for (int run = 0; run < 1000; run++)
+    {
+        for (int len = 0; len <= (int)sizeof(buf); len++)
+        {
+            uint8_t init8 = Random();
+            uint16_t init14 = (Random() << 8 | Random()) & 0x3fff;
+            uint16_t old14 = init14;
+
+            for (int i = 0; i < len; i++) buf[i] = Random();
+
+            crc14_bytes(len, buf, &old14);
+            Check("CmdCrc", len, calcCRC(buf, len, init8), CmdCrc::Calc(buf, len, init8));
+            Check("DataCrc", len, old14, DataCrc::Calc(buf, len, init14));
+            Check("TeslaCrc", len, GenCRC(buf, len), TeslaCrc::Calc(buf, len));
+            Check("LeafCrc", len, LeafBitwise(buf, len), LeafCrc::Calc(buf, len));
+            Check("BmwCrc", len, BMW_crc8(buf, len), BmwCrc::Calc(buf, len));
+
+            for (int bits = 0; bits <= 8; bits++)
+            {
+                uint16_t oldBits = old14;
+                uint8_t tail = Random();
+
+                crc14_bits(bits, tail, &oldBits);
+                Check("DataCrc bits", bits, oldBits, DataCrc::Bits(old14, tail, bits));
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < sizeof(cfgBlocks) / sizeof(cfgBlocks[0]); i++)
+    {
+        uint8_t block[6];
+
+        for (int j = 0; j < 6; j++) block[j] = cfgBlocks[i][j];
+        CheckBlock("BmbPec config block", block, 6);
+    }
+
+    for (int run = 0; run < 1000; run++)
+    {
+        uint8_t block[9];
+        int len = 6 + run % 4;
+        uint8_t tail = Random() & 0xC0;
+        uint16_t pec = 0x0010;
+
+        for (int i = 0; i < len - BMB_PEC_BYTES; i++) block[i] = Random();
+        crc14_bytes(len - BMB_PEC_BYTES, block, &pec);
+        crc14_bits(2, tail, &pec);
+        block[len - 2] = tail | (pec >> 8);
+        block[len - 1] = pec & 0xff;
+        CheckBlock("BmbPec read block", block, len);
+    }
+
+    printf("%s, %d mismatches\n", failures ? "FAILED" : "passed", failures);
+    return failures != 0;
+}
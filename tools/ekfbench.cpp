@@ -0,0 +1,94 @@
+/*
+ * This file is part of the RaVus BMS project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*  Host replay of a recorded trace through SocEkf, built with "make ekfbench".
+ *
+ *  ekfbench <capacity Ah> <initial SOC %> [-v] < trace.csv
+ *
+ *  Trace lines are "ms,mA,cell mV,°C[,reference SOC %]", lines starting
+ *  with # are skipped. Charge is integrated here the way the firmware's
+ *  coulomb counter does. Prints the final SOC, the RMS and worst error
+ *  against the reference column if there is one, and the time per step.
+ *  -v prints every step.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include "socekf.h"
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <capacity Ah> <initial SOC %%> [-v] < trace.csv\n", argv[0]);
+        return 1;
+    }
+
+    double capacity = atof(argv[1]);
+    bool verbose = argc > 3;
+    SocEkf::Model model = { 1000, 1000, 30000, 20, 500, 10000, SocEkf::defaultOcv, SocEkf::defaultOcvPoints };
+    SocEkf ekf;
+    char line[256];
+    long lastMs = -1, steps = 0, refs = 0;
+    double charge = 0, sqErr = 0, maxErr = 0, ns = 0;
+    //1 ppm of capacity in mA*ms
+    double unit = capacity * 3600.0;
+
+    ekf.Init(model, (int32_t)(atof(argv[2]) * 10000), 100000);
+
+    while (fgets(line, sizeof(line), stdin))
+    {
+        long ms;
+        int ma, mv, degC;
+        double ref;
+
+        if (line[0] == '#') continue;
+        int fields = sscanf(line, "%ld,%d,%d,%d,%lf", &ms, &ma, &mv, &degC, &ref);
+        if (fields < 4) continue;
+
+        int32_t dt = lastMs < 0 ? 0 : ms - lastMs;
+        charge += (double)ma * dt;
+        int32_t dSoc = (int32_t)(charge / unit);
+        charge -= dSoc * unit;
+        lastMs = ms;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        ekf.Predict(dSoc, ma, dt);
+        ekf.Update(mv, ma, degC);
+        ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        steps++;
+
+        double soc = ekf.GetSoc() / 10000.0;
+
+        if (fields == 5)
+        {
+            double err = fabs(soc - ref);
+            sqErr += err * err;
+            maxErr = err > maxErr ? err : maxErr;
+            refs++;
+        }
+        if (verbose)
+            printf("%ld,%.3f,%.1f\n", ms, soc, ekf.GetInnovation() / 1000.0);
+    }
+
+    printf("steps %ld, final SOC %.3f%%, %.0f ns/step\n", steps, ekf.GetSoc() / 10000.0, steps ? ns / steps : 0);
+    if (refs)
+        printf("error vs reference: rms %.3f%%, max %.3f%%\n", sqrt(sqErr / refs), maxErr);
+    return 0;
+}